@@ -2,11 +2,45 @@
 // Use of this source code is governed by the BSD 2-clause license, the MIT license, or at your choosing the BSL-1.0 license found in the LICENSE.*.txt files.
 // SPDX-License-Identifier: BSD-2-Clause OR MIT OR BSL-1.0
 
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
 #include <benchmark/benchmark.h>
 #include <task_thread_pool.hpp>
 
 #define NUM_THREADS 4
 
+/**
+ * Count calls to global operator new, to measure heap allocations per task.
+ */
+static std::atomic<size_t> num_heap_allocations{0};
+
+void* operator new(std::size_t size) {
+    ++num_heap_allocations;
+    if (void* p = std::malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+    std::free(p);
+}
+
+/**
+ * Report the number of heap allocations per task since start_count.
+ */
+static void report_allocs_per_task(benchmark::State& state, size_t start_count, size_t tasks_per_iteration) {
+    const size_t num_allocations = num_heap_allocations - start_count;
+    state.counters["allocs_per_task"] = static_cast<double>(num_allocations) /
+                                        static_cast<double>(state.iterations() * tasks_per_iteration);
+}
+
 /**
  * Measure pool constructor and destructor. This includes starting/stopping threads.
  * Use a fixed number of threads threads for consistency.
@@ -18,6 +52,16 @@ static void pool_create_destroy(benchmark::State& state) {
 }
 BENCHMARK(pool_create_destroy);
 
+/**
+ * Measure constructor and destructor of a pool that never receives a task, with deferred thread startup.
+ */
+static void pool_create_destroy_deferred(benchmark::State& state) {
+    for ([[maybe_unused]] auto _ : state) {
+        task_thread_pool::task_thread_pool pool(NUM_THREADS, task_thread_pool::deferred_start);
+    }
+}
+BENCHMARK(pool_create_destroy_deferred);
+
 /**
  * Measure submitting a pre-packaged std::packaged_task.
  */
@@ -123,6 +167,7 @@ BENCHMARK(submit_int_lambda_future)->ArgName("paused")->Arg(true)->Arg(false);
 static void run_1k_packaged_tasks(benchmark::State& state) {
     auto func = []{};
 
+    const size_t start_count = num_heap_allocations;
     for ([[maybe_unused]] auto _ : state) {
         task_thread_pool::task_thread_pool pool(NUM_THREADS);
         for (int i = 0; i < 1000; ++i) {
@@ -130,6 +175,7 @@ static void run_1k_packaged_tasks(benchmark::State& state) {
             pool.submit_detach(std::move(task));
         }
     }
+    report_allocs_per_task(state, start_count, 1000);
 }
 BENCHMARK(run_1k_packaged_tasks);
 
@@ -139,12 +185,14 @@ BENCHMARK(run_1k_packaged_tasks);
 static void run_1k_void_lambdas(benchmark::State& state) {
     auto func = []{};
 
+    const size_t start_count = num_heap_allocations;
     for ([[maybe_unused]] auto _ : state) {
         task_thread_pool::task_thread_pool pool(NUM_THREADS);
         for (int i = 0; i < 1000; ++i) {
             pool.submit_detach(func);
         }
     }
+    report_allocs_per_task(state, start_count, 1000);
 }
 BENCHMARK(run_1k_void_lambdas);
 
@@ -154,6 +202,7 @@ BENCHMARK(run_1k_void_lambdas);
 static void run_1k_int_lambdas(benchmark::State& state) {
     auto func = []{ return 1; };
 
+    const size_t start_count = num_heap_allocations;
     for ([[maybe_unused]] auto _ : state) {
         task_thread_pool::task_thread_pool pool(NUM_THREADS);
         for (int i = 0; i < 1000; ++i) {
@@ -161,6 +210,7 @@ static void run_1k_int_lambdas(benchmark::State& state) {
             benchmark::DoNotOptimize(f);
         }
     }
+    report_allocs_per_task(state, start_count, 1000);
 }
 BENCHMARK(run_1k_int_lambdas);
 
@@ -92,13 +92,25 @@
 #define TASK_THREAD_POOL_VERSION_MINOR 0
 #define TASK_THREAD_POOL_VERSION_PATCH 10
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
 #include <functional>
 #include <future>
+#include <memory>
 #include <mutex>
 #include <queue>
+#include <stdexcept>
+#include <stack>
+#include <string>
 #include <thread>
 #include <type_traits>
+#include <utility>
+#include <vector>
 
 // MSVC does not correctly set the __cplusplus macro by default, so we must read it from _MSVC_LANG
 // See https://devblogs.microsoft.com/cppblog/msvc-now-correctly-reports-__cplusplus/
@@ -114,271 +126,2472 @@
 #define TTP_NODISCARD
 #endif
 
+// Statically-defined tracepoints (USDT) for perf, bpftrace, and SystemTap. They cost a nop when nobody is attached.
+// Opt in by defining TTP_ENABLE_USDT, which requires <sys/sdt.h> from systemtap-sdt-dev.
+// Each probe's arguments are the pool's address and one or two probe-specific values. See the README.
+#if defined(TTP_ENABLE_USDT)
+#include <sys/sdt.h>
+#define TTP_PROBE(name, pool, arg) DTRACE_PROBE2(task_thread_pool, name, pool, arg)
+#define TTP_PROBE3(name, pool, arg1, arg2) DTRACE_PROBE3(task_thread_pool, name, pool, arg1, arg2)
+#else
+#define TTP_PROBE(name, pool, arg) do { (void)(pool); (void)(arg); } while (false)
+#define TTP_PROBE3(name, pool, arg1, arg2) do { (void)(pool); (void)(arg1); (void)(arg2); } while (false)
+#endif
+
+#if defined(__linux__) || defined(__APPLE__)
+#include <pthread.h>
+#endif
+
 namespace task_thread_pool {
 
-#if !TTP_CXX17
     /**
      * A reimplementation of std::decay_t, which is only available since C++14.
      */
     template <class T>
     using decay_t = typename std::decay<T>::type;
-#endif
 
     /**
-     * A fast and lightweight thread pool that uses C++11 threads.
+     * Tag type to select the task_thread_pool constructor that defers starting worker threads.
+     */
+    struct deferred_start_t {
+        explicit deferred_start_t() = default;
+    };
+
+    /**
+     * Pass to the task_thread_pool constructor to start worker threads only when the first task is submitted.
+     */
+    constexpr deferred_start_t deferred_start{};
+
+    /**
+     * The exception stored in the future of a task submitted with submit_with_deadline() that did not start
+     * before its deadline.
+     */
+    class task_expired : public std::runtime_error {
+    public:
+        task_expired() : std::runtime_error("task deadline passed before it started") {}
+    };
+
+    /**
+     * The exception stored in the future of a task that was cancelled with cancellation_handle::cancel().
      */
-    class task_thread_pool {
+    class task_cancelled : public std::runtime_error {
     public:
+        task_cancelled() : std::runtime_error("task was cancelled before it started") {}
+    };
+
+    class blocking_scope;
+    class cpu_arbiter;
+
+    /**
+     * Value of current_worker_index() on threads that are not worker threads.
+     */
+    constexpr unsigned int no_worker_index = static_cast<unsigned int>(-1);
+
+    /**
+     * Creates a worker thread's context. Called with the worker's index. See set_worker_context().
+     */
+    using worker_context_factory = std::function<std::shared_ptr<void>(unsigned int)>;
+
+    namespace detail {
         /**
-         * Create a task_thread_pool and start worker threads.
-         *
-         * @param num_threads Number of worker threads. If 0 then number of threads is equal to the
-         *                    number of physical cores on the machine, as given by std::thread::hardware_concurrency().
+         * A unique address per type, to check the type of a worker context without RTTI.
          */
-        explicit task_thread_pool(unsigned int num_threads = 0) {
-            if (num_threads < 1) {
-                num_threads = std::thread::hardware_concurrency();
-                if (num_threads < 1) { num_threads = 1; }
-            }
-            start_threads(num_threads);
+        template <typename T>
+        const void* type_tag() {
+            static const char tag = 0;
+            return &tag;
         }
 
         /**
-         * Finish all tasks left in the queue then shut down worker threads.
-         * If the pool is currently paused then it is resumed.
+         * What a worker thread passes to each task it runs. Lives on the worker's stack.
          */
-        ~task_thread_pool() {
-            unpause();
-            wait_for_queued_tasks();
-            stop_all_threads();
+        struct worker_frame {
+            unsigned int index;
+
+            /**
+             * The worker's context, created by the factory given to set_worker_context(), or null.
+             */
+            void* context;
+
+            /**
+             * type_tag() of the context's type.
+             */
+            const void* context_type;
+        };
+
+        /**
+         * The frame of a task that is not run by a worker.
+         */
+        inline const worker_frame& no_worker_frame() {
+            static const worker_frame frame = {no_worker_index, nullptr, nullptr};
+            return frame;
         }
 
         /**
-         * Drop all tasks that have been submitted but not yet started by a worker.
+         * What a thread knows about itself if it is a worker thread.
          *
-         * Tasks already in progress continue executing.
+         * Trivially destructible and constant-initialized, so accessing it costs no thread_local initialization
+         * check.
          */
-        void clear_task_queue() {
-            const std::lock_guard<std::mutex> tasks_lock(task_mutex);
-            tasks = {};
+        struct worker_info {
+            const worker_frame* frame = nullptr;
+
+            /**
+             * The arbiter whose CPU token the thread holds while running its current task, if any.
+             */
+            cpu_arbiter* token_arbiter = nullptr;
+        };
+
+        inline worker_info& this_worker() {
+            static thread_local worker_info info;
+            return info;
         }
 
         /**
-         * Get number of enqueued tasks.
+         * Get a worker's context as a T.
          *
-         * @return Number of tasks that have been enqueued but not yet started.
+         * @throws std::logic_error if the worker has no context of type T.
          */
-        TTP_NODISCARD size_t get_num_queued_tasks() const {
-            const std::lock_guard<std::mutex> tasks_lock(task_mutex);
-            return tasks.size();
+        template <typename T>
+        T& worker_context_of(const worker_frame& frame) {
+            if (!frame.context || frame.context_type != type_tag<T>()) {
+                throw std::logic_error("task_thread_pool: the worker has no context of the requested type");
+            }
+            return *static_cast<T*>(frame.context);
         }
 
         /**
-         * Get number of in-progress tasks.
-         *
-         * @return Approximate number of tasks currently being processed by worker threads.
+         * Whether a task callable takes the worker_frame of the worker that runs it. See basic_task.
          */
-        TTP_NODISCARD size_t get_num_running_tasks() const {
-            const std::lock_guard<std::mutex> tasks_lock(task_mutex);
-            return num_inflight_tasks;
+        template <typename Fn>
+        struct takes_worker_frame : std::false_type {};
+
+        /**
+         * Smallest and largest block sizes served by the per-thread block caches. Larger requests go straight to
+         * operator new.
+         */
+        constexpr size_t min_cached_block_size = 16;
+        constexpr size_t max_cached_block_size = 1024;
+
+        /**
+         * Number of size classes: 16, 32, 64, ..., 1024 bytes.
+         */
+        constexpr size_t num_block_size_classes = 7;
+
+        /**
+         * Number of free blocks moved between a thread's cache and the shared depot at once.
+         */
+        constexpr size_t block_batch_size = 32;
+
+        /**
+         * Maximum number of batches per size class held by the shared depot. Further batches are freed.
+         */
+        constexpr size_t max_depot_batches = 256;
+
+        inline size_t block_size_class(size_t size) {
+            size_t cls = 0;
+            size_t class_size = min_cached_block_size;
+            while (class_size < size) {
+                class_size *= 2;
+                ++cls;
+            }
+            return cls;
+        }
+
+        inline size_t block_class_size(size_t cls) {
+            return min_cached_block_size << cls;
         }
 
         /**
-         * Get total number of tasks in the pool.
-         *
-         * @return Approximate number of tasks both enqueued and running.
+         * A free block, linked into a free list.
          */
-        TTP_NODISCARD size_t get_num_tasks() const {
-            const std::lock_guard<std::mutex> tasks_lock(task_mutex);
-            return tasks.size() + num_inflight_tasks;
+        struct free_block {
+            free_block* next;
+        };
+
+        /**
+         * A linked list of free blocks of one size class.
+         */
+        struct block_batch {
+            free_block* head;
+            size_t count;
+        };
+
+        /**
+         * Process-wide store of free block batches, shared by all threads. Threads that free more blocks than they
+         * allocate, such as workers destroying tasks, push batches here. Threads that allocate more than they free,
+         * such as the thread that submits tasks, take batches from here.
+         */
+        class block_depot {
+        public:
+            bool pop(size_t cls, block_batch& batch) {
+                const std::lock_guard<std::mutex> lock(mutex);
+                if (batches[cls].empty()) {
+                    return false;
+                }
+                batch = batches[cls].back();
+                batches[cls].pop_back();
+                return true;
+            }
+
+            void push(size_t cls, block_batch batch) {
+                {
+                    const std::lock_guard<std::mutex> lock(mutex);
+                    if (batches[cls].size() < max_depot_batches) {
+                        batches[cls].push_back(batch);
+                        return;
+                    }
+                }
+                while (batch.head) {
+                    free_block* next = batch.head->next;
+                    ::operator delete(batch.head);
+                    batch.head = next;
+                }
+            }
+
+        protected:
+            std::mutex mutex;
+            std::vector<block_batch> batches[num_block_size_classes];
+        };
+
+        /**
+         * The depot is never destroyed, so that threads that exit during static destruction can still return
+         * their blocks to it.
+         */
+        inline block_depot& global_block_depot() {
+            static block_depot* depot = new block_depot;
+            return *depot;
         }
 
         /**
-         * Get number of worker threads.
+         * A thread's free lists, one per size class. Allocating and freeing a cached block takes no lock.
          *
-         * @return Number of worker threads.
+         * Trivially destructible so that it stays usable while other thread_local objects are destroyed.
+         * Every block is a separate operator new allocation, so a block may always be freed with operator delete.
          */
-        TTP_NODISCARD unsigned int get_num_threads() const {
-            const std::lock_guard<std::recursive_mutex> threads_lock(thread_mutex);
-            return static_cast<unsigned int>(threads.size());
+        struct block_cache {
+            block_batch lists[num_block_size_classes];
+
+            /**
+             * Set once the thread's cache has been flushed at thread exit. Blocks then bypass the cache.
+             */
+            bool disabled;
+
+            void* allocate(size_t cls) {
+                block_batch& list = lists[cls];
+                if (!list.head && (disabled || !global_block_depot().pop(cls, list))) {
+                    return ::operator new(block_class_size(cls));
+                }
+                free_block* block = list.head;
+                list.head = block->next;
+                --list.count;
+                return block;
+            }
+
+            void deallocate(void* p, size_t cls) {
+                if (disabled) {
+                    ::operator delete(p);
+                    return;
+                }
+
+                block_batch& list = lists[cls];
+                auto* block = static_cast<free_block*>(p);
+                block->next = list.head;
+                list.head = block;
+
+                if (++list.count >= 2 * block_batch_size) {
+                    // return a batch, keeping the rest cache-hot for this thread
+                    block_batch batch{list.head, block_batch_size};
+                    free_block* last = list.head;
+                    for (size_t i = 1; i < block_batch_size; ++i) {
+                        last = last->next;
+                    }
+                    list.head = last->next;
+                    list.count -= block_batch_size;
+                    last->next = nullptr;
+                    global_block_depot().push(cls, batch);
+                }
+            }
+
+            void flush() {
+                for (size_t cls = 0; cls < num_block_size_classes; ++cls) {
+                    if (lists[cls].head) {
+                        global_block_depot().push(cls, lists[cls]);
+                    }
+                    lists[cls] = block_batch{nullptr, 0};
+                }
+            }
+        };
+
+        /**
+         * Returns a thread's cached blocks to the depot when the thread exits.
+         */
+        struct block_cache_flusher {
+            block_cache& cache;
+
+            explicit block_cache_flusher(block_cache& cache) : cache(cache) {}
+
+            ~block_cache_flusher() {
+                cache.flush();
+                cache.disabled = true;
+            }
+        };
+
+        inline block_cache& this_thread_block_cache() {
+            static thread_local block_cache cache{};
+            static thread_local block_cache_flusher flusher(cache);
+            (void)flusher;
+            return cache;
+        }
+
+        inline void* allocate_block(size_t size) {
+            if (size > max_cached_block_size) {
+                return ::operator new(size);
+            }
+            return this_thread_block_cache().allocate(block_size_class(size));
+        }
+
+        inline void deallocate_block(void* p, size_t size) noexcept {
+            if (size > max_cached_block_size) {
+                ::operator delete(p);
+                return;
+            }
+            this_thread_block_cache().deallocate(p, block_size_class(size));
         }
 
         /**
-         * Set number of worker threads. Will start or stop worker threads as necessary.
+         * An allocator that recycles small blocks through per-thread free lists instead of the global heap.
          *
-         * @param num_threads Number of worker threads. If 0 then number of threads is equal to the
-         *                    number of physical cores on the machine, as given by std::thread::hardware_concurrency().
-         * @return Previous number of worker threads.
+         * Blocks freed on one thread are reused by that thread, and surplus blocks are handed to other threads
+         * in batches through a shared depot, so a steady stream of tasks from a submitting thread to worker threads
+         * allocates from the heap only until the free lists are warm. Over-aligned types bypass the free lists.
          */
-        unsigned int set_num_threads(unsigned int num_threads) {
-            const std::lock_guard<std::recursive_mutex> threads_lock(thread_mutex);
-            unsigned int previous_num_threads = get_num_threads();
+        template <typename T>
+        struct recycling_allocator {
+            using value_type = T;
 
-            if (num_threads < 1) {
-                num_threads = std::thread::hardware_concurrency();
-                if (num_threads < 1) { num_threads = 1; }
+            recycling_allocator() noexcept = default;
+
+            template <typename U>
+            recycling_allocator(const recycling_allocator<U>&) noexcept {}
+
+            T* allocate(size_t n) {
+                return allocate(n, over_aligned());
             }
 
-            if (previous_num_threads <= num_threads) {
-                // expanding the thread pool
-                start_threads(num_threads - previous_num_threads);
-            } else {
-                // contracting the thread pool
-                stop_all_threads();
-                {
-                    const std::lock_guard<std::mutex> tasks_lock(task_mutex);
-                    pool_running = true;
+            void deallocate(T* p, size_t n) noexcept {
+                deallocate(p, n, over_aligned());
+            }
+
+            template <typename U>
+            bool operator==(const recycling_allocator<U>&) const noexcept { return true; }
+
+            template <typename U>
+            bool operator!=(const recycling_allocator<U>&) const noexcept { return false; }
+
+        protected:
+            /**
+             * Cached blocks are only aligned to std::max_align_t. Over-aligned types use std::allocator instead.
+             */
+            using over_aligned = std::integral_constant<bool, (alignof(T) > alignof(std::max_align_t))>;
+
+            T* allocate(size_t n, std::false_type /* over_aligned */) {
+                return static_cast<T*>(allocate_block(n * sizeof(T)));
+            }
+
+            T* allocate(size_t n, std::true_type /* over_aligned */) {
+                return std::allocator<T>().allocate(n);
+            }
+
+            void deallocate(T* p, size_t n, std::false_type /* over_aligned */) noexcept {
+                deallocate_block(p, n * sizeof(T));
+            }
+
+            void deallocate(T* p, size_t n, std::true_type /* over_aligned */) noexcept {
+                std::allocator<T>().deallocate(p, n);
+            }
+        };
+
+        /**
+         * A move-only type-erased void() callable, used for the task queue.
+         *
+         * Callables up to inline_size bytes are stored in place. Larger ones are allocated with recycling_allocator.
+         * Unlike std::packaged_task<void()>, storing a task does not allocate a shared state.
+         */
+        template <size_t InlineSize>
+        class basic_task {
+        public:
+            static constexpr size_t inline_size = InlineSize;
+
+            static_assert(inline_size >= sizeof(void*), "inline storage must be able to hold a pointer");
+
+            basic_task() noexcept = default;
+
+            template <typename F, typename Fn = typename std::decay<F>::type,
+                      typename = typename std::enable_if<!std::is_same<Fn, basic_task>::value>::type>
+            basic_task(F&& func) { // NOLINT(google-explicit-constructor)
+                emplace<Fn>(std::forward<F>(func), std::integral_constant<bool, fits_inline<Fn>()>());
+            }
+
+            basic_task(basic_task&& other) noexcept {
+                move_from(other);
+            }
+
+            basic_task& operator=(basic_task&& other) noexcept {
+                if (this != &other) {
+                    reset();
+                    move_from(other);
                 }
-                start_threads(num_threads);
+                return *this;
             }
 
-            return previous_num_threads;
+            basic_task(const basic_task&) = delete;
+            basic_task& operator=(const basic_task&) = delete;
+
+            ~basic_task() {
+                reset();
+            }
+
+            void operator()() {
+                ops->invoke(&storage, no_worker_frame());
+            }
+
+            /**
+             * Run the task on a worker. Callables that take the worker_frame get the worker's.
+             */
+            void operator()(const worker_frame& frame) {
+                ops->invoke(&storage, frame);
+            }
+
+            explicit operator bool() const noexcept {
+                return ops != nullptr;
+            }
+
+        protected:
+            struct operations {
+                void (*invoke)(void* storage, const worker_frame& frame);
+                void (*move)(void* dst, void* src) noexcept;
+                void (*destroy)(void* storage) noexcept;
+            };
+
+            template <typename Fn>
+            static void call(Fn& func, const worker_frame&, std::false_type /* takes frame */) {
+                func();
+            }
+
+            template <typename Fn>
+            static void call(Fn& func, const worker_frame& frame, std::true_type /* takes frame */) {
+                func(frame);
+            }
+
+            template <typename Fn>
+            static constexpr bool fits_inline() {
+                return sizeof(Fn) <= inline_size && alignof(Fn) <= alignof(std::max_align_t) &&
+                    std::is_nothrow_move_constructible<Fn>::value;
+            }
+
+            /**
+             * Operations for a callable stored in place.
+             */
+            template <typename Fn>
+            struct inline_operations {
+                static void invoke(void* storage, const worker_frame& frame) {
+                    call(*static_cast<Fn*>(storage), frame, takes_worker_frame<Fn>());
+                }
+
+                static void move(void* dst, void* src) noexcept {
+                    new (dst) Fn(std::move(*static_cast<Fn*>(src)));
+                    static_cast<Fn*>(src)->~Fn();
+                }
+
+                static void destroy(void* storage) noexcept {
+                    static_cast<Fn*>(storage)->~Fn();
+                }
+
+                static const operations* get() {
+                    static const operations ops = {&invoke, &move, &destroy};
+                    return &ops;
+                }
+            };
+
+            /**
+             * Operations for a callable stored on the heap. The storage holds a pointer to it.
+             */
+            template <typename Fn>
+            struct heap_operations {
+                static Fn*& pointer(void* storage) {
+                    return *static_cast<Fn**>(storage);
+                }
+
+                static void invoke(void* storage, const worker_frame& frame) {
+                    call(*pointer(storage), frame, takes_worker_frame<Fn>());
+                }
+
+                static void move(void* dst, void* src) noexcept {
+                    new (dst) Fn*(pointer(src));
+                }
+
+                static void destroy(void* storage) noexcept {
+                    Fn* func = pointer(storage);
+                    func->~Fn();
+                    recycling_allocator<Fn>().deallocate(func, 1);
+                }
+
+                static const operations* get() {
+                    static const operations ops = {&invoke, &move, &destroy};
+                    return &ops;
+                }
+            };
+
+            template <typename Fn, typename F>
+            void emplace(F&& func, std::true_type /* inline */) {
+                new (&storage) Fn(std::forward<F>(func));
+                ops = inline_operations<Fn>::get();
+            }
+
+            template <typename Fn, typename F>
+            void emplace(F&& func, std::false_type /* inline */) {
+                recycling_allocator<Fn> alloc;
+                Fn* p = alloc.allocate(1);
+                try {
+                    new (p) Fn(std::forward<F>(func));
+                } catch (...) {
+                    alloc.deallocate(p, 1);
+                    throw;
+                }
+                new (&storage) Fn*(p);
+                ops = heap_operations<Fn>::get();
+            }
+
+            void move_from(basic_task& other) noexcept {
+                if (other.ops) {
+                    other.ops->move(&storage, &other.storage);
+                    ops = other.ops;
+                    other.ops = nullptr;
+                }
+            }
+
+            void reset() noexcept {
+                if (ops) {
+                    ops->destroy(&storage);
+                    ops = nullptr;
+                }
+            }
+
+            alignas(std::max_align_t) unsigned char storage[inline_size];
+            const operations* ops = nullptr;
+        };
+
+        /**
+         * Set a promise from the result of a callable.
+         */
+        template <typename R, typename Fn>
+        void fulfill(std::promise<R>& promise, Fn& func) {
+            promise.set_value(func());
+        }
+
+        template <typename Fn>
+        void fulfill(std::promise<void>& promise, Fn& func) {
+            func();
+            promise.set_value();
         }
 
         /**
-         * Stop executing queued tasks. Use `unpause()` to resume. Note: Destroying the pool will implicitly unpause.
-         *
-         * Any in-progress tasks continue executing.
+         * A task that runs a callable and stores its result or exception in a promise.
+         * The promise's shared state is allocated with recycling_allocator.
          */
-        void pause() {
-            const std::lock_guard<std::mutex> tasks_lock(task_mutex);
-            pool_paused = true;
+        template <typename R, typename Fn>
+        struct promise_task {
+            std::promise<R> promise;
+            Fn func;
+
+            void operator()() {
+                try {
+                    fulfill(promise, func);
+                } catch (...) {
+                    promise.set_exception(std::current_exception());
+                }
+            }
+        };
+
+        /**
+         * The result type of calling an Fn with Args. The default return type of the submit methods.
+         */
+#if TTP_CXX17
+        template <typename Fn, typename... Args>
+        using invoke_result_t = std::invoke_result_t<Fn, Args...>;
+#else
+        template <typename Fn, typename... Args>
+        using invoke_result_t = typename std::result_of<Fn(Args...)>::type;
+#endif
+
+        /**
+         * The type of a callable bound to its arguments with std::bind.
+         */
+        template <typename F, typename... A>
+        using bound_t = decltype(std::bind(std::declval<F>(), std::declval<A>()...));
+
+        /**
+         * Bind a callable to its arguments in a promise_task that returns an R.
+         */
+        template <typename R, typename F, typename... A>
+        promise_task<R, bound_t<F, A...>> make_promise_task(F&& func, A&&... args) {
+            return {std::promise<R>(std::allocator_arg, recycling_allocator<char>()),
+                    std::bind(std::forward<F>(func), std::forward<A>(args)...)};
         }
 
         /**
-         * Resume executing queued tasks.
+         * A task whose callable takes the context of the worker that runs it. See submit_with_context().
+         */
+        template <typename T, typename Fn>
+        struct context_task {
+            Fn func;
+
+            void operator()(const worker_frame& frame) {
+                func(worker_context_of<T>(frame));
+            }
+        };
+
+        template <typename T, typename Fn>
+        struct takes_worker_frame<context_task<T, Fn>> : std::true_type {};
+
+        /**
+         * A context_task that stores its result or exception in a promise.
+         */
+        template <typename R, typename T, typename Fn>
+        struct context_promise_task {
+            std::promise<R> promise;
+            Fn func;
+
+            void operator()(const worker_frame& frame) {
+                try {
+                    fulfill(frame, std::is_void<R>());
+                } catch (...) {
+                    promise.set_exception(std::current_exception());
+                }
+            }
+
+        protected:
+            void fulfill(const worker_frame& frame, std::false_type /* void */) {
+                promise.set_value(func(worker_context_of<T>(frame)));
+            }
+
+            void fulfill(const worker_frame& frame, std::true_type /* void */) {
+                func(worker_context_of<T>(frame));
+                promise.set_value();
+            }
+        };
+
+        template <typename R, typename T, typename Fn>
+        struct takes_worker_frame<context_promise_task<R, T, Fn>> : std::true_type {};
+
+        /**
+         * A promise_task that fails with task_expired instead of running if it starts after its deadline.
+         *
+         * Workers invoke expired tasks straight off the deadline heap, with task_mutex held, so that only the
+         * promise is failed.
+         */
+        template <typename R, typename Fn>
+        struct deadline_promise_task {
+            promise_task<R, Fn> task;
+            std::chrono::steady_clock::time_point deadline;
+
+            /**
+             * The pool's counter of expired tasks. The pool outlives its tasks.
+             */
+            std::atomic<size_t>* num_expired_tasks;
+
+            void operator()() {
+                if (std::chrono::steady_clock::now() > deadline) {
+                    num_expired_tasks->fetch_add(1, std::memory_order_relaxed);
+                    task.promise.set_exception(std::make_exception_ptr(task_expired()));
+                    return;
+                }
+                task();
+            }
+        };
+
+        /**
+         * An entry in a pool's earliest-deadline-first heap.
+         */
+        template <typename Task>
+        struct deadline_entry {
+            std::chrono::steady_clock::time_point deadline;
+
+            /**
+             * Submission order, to run tasks with equal deadlines in FIFO order.
+             */
+            uint64_t seq;
+
+            Task task;
+        };
+
+        /**
+         * Maximum number of tasks with a deadline that run in a row while tasks without one wait. After that
+         * one task without a deadline runs, so that a steady stream of deadline tasks cannot starve them.
+         */
+        constexpr unsigned int max_deadline_burst = 8;
+
+        /**
+         * Heap order for deadline entries: the top of the heap has the earliest deadline.
+         */
+        struct later_deadline {
+            template <typename Entry>
+            bool operator()(const Entry& a, const Entry& b) const {
+                return a.deadline > b.deadline || (a.deadline == b.deadline && a.seq > b.seq);
+            }
+        };
+
+        /**
+         * Fail a cancelled task's future, if it has one.
+         */
+        template <typename Fn>
+        void set_cancelled(Fn&) {}
+
+        template <typename R, typename Fn>
+        void set_cancelled(promise_task<R, Fn>& task) {
+            task.promise.set_exception(std::make_exception_ptr(task_cancelled()));
+        }
+
+        /**
+         * The control block of a cancellable task, shared by its queue entry and its cancellation_handle.
+         * Whichever of the worker and cancel() first moves the task out of the queued state wins.
+         */
+        class cancellable_state_base {
+        public:
+            virtual ~cancellable_state_base() = default;
+
+            /**
+             * Run the task, unless it was cancelled. Called by a worker.
+             */
+            void run() {
+                if (transition(running)) {
+                    invoke();
+                }
+            }
+
+            /**
+             * Cancel the task if it has not started, destroying the callable.
+             *
+             * @return true if the task was cancelled.
+             */
+            bool cancel() {
+                if (!transition(cancelled)) {
+                    return false;
+                }
+                fail();
+                return true;
+            }
+
+            /**
+             * @return true if the task was cancelled or dropped. A worker may skip it without running it.
+             */
+            bool is_cancelled() const {
+                return state.load(std::memory_order_acquire) == cancelled;
+            }
+
+            /**
+             * Destroy the callable of a task that was dropped from the queue without running.
+             */
+            void abandon() {
+                if (transition(cancelled)) {
+                    discard();
+                }
+            }
+
+        protected:
+            enum : int { queued, running, cancelled };
+
+            bool transition(int to) {
+                int expected = queued;
+                return state.compare_exchange_strong(expected, to, std::memory_order_acq_rel);
+            }
+
+            virtual void invoke() = 0;
+            virtual void fail() = 0;
+            virtual void discard() = 0;
+
+            std::atomic<int> state{queued};
+        };
+
+        /**
+         * A cancellable task's control block that stores the callable in place. The callable is destroyed as soon
+         * as the task runs, is cancelled, or is dropped, even while the block is kept alive by a handle.
+         */
+        template <typename Fn>
+        class cancellable_state final : public cancellable_state_base {
+        public:
+            template <typename F>
+            explicit cancellable_state(F&& func) {
+                new (&storage) Fn(std::forward<F>(func));
+            }
+
+            ~cancellable_state() override {
+                if (state.load(std::memory_order_acquire) == queued) {
+                    callable().~Fn();
+                }
+            }
+
+            cancellable_state(const cancellable_state&) = delete;
+            cancellable_state& operator=(const cancellable_state&) = delete;
+
+        protected:
+            Fn& callable() {
+                return *reinterpret_cast<Fn*>(&storage);
+            }
+
+            void invoke() override {
+                try {
+                    callable()();
+                } catch (...) {
+                    callable().~Fn();
+                    throw;
+                }
+                callable().~Fn();
+            }
+
+            void fail() override {
+                set_cancelled(callable());
+                callable().~Fn();
+            }
+
+            void discard() override {
+                callable().~Fn();
+            }
+
+            alignas(Fn) unsigned char storage[sizeof(Fn)];
+        };
+
+        /**
+         * A cancellable task's entry in the task queue. Once the task is cancelled it is a tombstone that
+         * workers skip.
+         */
+        struct cancellable_task_ref {
+            explicit cancellable_task_ref(std::shared_ptr<cancellable_state_base> state) : state(std::move(state)) {}
+
+            cancellable_task_ref(cancellable_task_ref&&) noexcept = default;
+            cancellable_task_ref(const cancellable_task_ref&) = delete;
+
+            ~cancellable_task_ref() {
+                if (state) {
+                    state->abandon();
+                }
+            }
+
+            void operator()() {
+                state->run();
+            }
+
+            std::shared_ptr<cancellable_state_base> state;
+        };
+
+        /**
+         * Callbacks that run around every task. See set_task_hooks().
+         */
+        struct task_hooks {
+            std::function<void(const char*)> before;
+            std::function<void(const char*)> after;
+        };
+
+        /**
+         * Build a thread name.
+         *
+         * @param prefix Shortened as needed to fit Linux's limit of 15 characters.
+         * @param suffix Kept whole, such as the worker index.
+         */
+        inline std::string make_thread_name(const std::string& prefix, const std::string& suffix) {
+            const size_t max_name_length = 15;
+            const size_t max_prefix_length = suffix.size() < max_name_length ? max_name_length - suffix.size() : 0;
+            return (prefix.substr(0, max_prefix_length) + suffix).substr(0, max_name_length);
+        }
+
+        /**
+         * Name the calling thread, for debuggers, top, and profilers. Only supported on Linux and macOS.
+         * See make_thread_name().
+         */
+        inline void name_this_thread(const std::string& prefix, const std::string& suffix) {
+#if defined(__APPLE__)
+            pthread_setname_np(make_thread_name(prefix, suffix).c_str());
+#elif defined(__linux__)
+            pthread_setname_np(pthread_self(), make_thread_name(prefix, suffix).c_str());
+#else
+            (void)prefix;
+            (void)suffix;
+#endif
+        }
+
+#if defined(__linux__)
+        /**
+         * Name another running thread. Only Linux can name threads other than the calling one.
+         * See make_thread_name().
+         */
+        inline void name_thread(std::thread& thread, const std::string& prefix, const std::string& suffix) {
+            pthread_setname_np(thread.native_handle(), make_thread_name(prefix, suffix).c_str());
+        }
+#endif
+    }
+
+    /**
+     * Get the index of the calling worker thread within its pool.
+     *
+     * Worker threads are numbered from 0 to get_num_threads() - 1. A worker keeps its index for as long as it runs,
+     * so the index can be used to address per-worker data such as scratch buffers. Resizing the pool restarts
+     * workers. Compensating threads started by a blocking_scope do not have an index.
+     *
+     * @return The index, or no_worker_index if the calling thread is not a pool worker thread.
+     */
+    inline unsigned int current_worker_index() {
+        const detail::worker_frame* frame = detail::this_worker().frame;
+        return frame ? frame->index : no_worker_index;
+    }
+
+    /**
+     * Get the calling worker thread's context, created by the factory given to set_worker_context() when
+     * the worker started. Tasks submitted with submit_with_context() are instead handed the context directly.
+     *
+     * @tparam T The type of the context.
+     * @return Pointer to the context, or nullptr if the calling thread is not a pool worker thread or its context is
+     *         not a T.
+     */
+    template <typename T>
+    T* current_worker_context() {
+        const detail::worker_frame* frame = detail::this_worker().frame;
+        if (!frame || frame->context_type != detail::type_tag<T>()) {
+            return nullptr;
+        }
+        return static_cast<T*>(frame->context);
+    }
+
+    /**
+     * A process-wide budget of CPU tokens shared by several pools, so that together they run no more tasks at once
+     * than there are cores. See set_cpu_arbiter().
+     *
+     * A worker of a pool that uses an arbiter takes a token before it starts a task and returns it when the task
+     * finishes. Workers that find no token left park until another pool's worker returns one, so capacity that one
+     * pool leaves idle flows to pools that are busy.
+     */
+    class cpu_arbiter {
+    public:
+        /**
+         * @param num_tokens Number of tasks that may run at once across all pools. If 0 then number of tokens is
+         *                   equal to the number of physical cores, as given by std::thread::hardware_concurrency().
+         */
+        explicit cpu_arbiter(unsigned int num_tokens = 0) {
+            if (num_tokens < 1) {
+                num_tokens = std::thread::hardware_concurrency();
+                if (num_tokens < 1) { num_tokens = 1; }
+            }
+            this->num_tokens = num_tokens;
+            available = static_cast<int>(num_tokens);
+        }
+
+        cpu_arbiter(const cpu_arbiter&) = delete;
+        cpu_arbiter& operator=(const cpu_arbiter&) = delete;
+
+        /**
+         * Take a token if one is available. Does not block.
+         *
+         * @return true if a token was taken.
+         */
+        bool try_acquire() {
+            int n = available.load();
+            while (n > 0) {
+                if (available.compare_exchange_weak(n, n - 1)) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        /**
+         * Take a token, blocking until one is available.
+         */
+        void acquire() {
+            acquire([] { return false; });
+        }
+
+        /**
+         * Take a token, blocking until one is available or until the wait is cancelled.
+         *
+         * @param cancelled Checked while waiting. Whatever makes it true must then call interrupt().
+         * @return true if a token was taken, false if the wait was cancelled.
+         */
+        template <typename Predicate>
+        bool acquire(Predicate cancelled) {
+            if (try_acquire()) {
+                return true;
+            }
+            std::unique_lock<std::mutex> lock(mutex);
+            ++num_waiters;
+            bool acquired = false;
+            token_cv.wait(lock, [&] { return (acquired = try_acquire()) || cancelled(); });
+            --num_waiters;
+            if (!acquired && available.load() > 0) {
+                // this thread may have consumed the notification of a returned token
+                token_cv.notify_one();
+            }
+            return acquired;
+        }
+
+        /**
+         * Return a token.
+         */
+        void release() {
+            available.fetch_add(1);
+            if (num_waiters.load() > 0) {
+                const std::lock_guard<std::mutex> lock(mutex);
+                token_cv.notify_one();
+            }
+        }
+
+        /**
+         * Wake all threads blocked in acquire() so they check whether their wait was cancelled.
+         */
+        void interrupt() {
+            const std::lock_guard<std::mutex> lock(mutex);
+            token_cv.notify_all();
+        }
+
+        /**
+         * @return Total number of tokens.
+         */
+        TTP_NODISCARD unsigned int get_num_tokens() const {
+            return num_tokens;
+        }
+
+        /**
+         * @return Approximate number of tokens not currently taken.
+         */
+        TTP_NODISCARD unsigned int get_num_available_tokens() const {
+            return static_cast<unsigned int>(available.load(std::memory_order_relaxed));
+        }
+
+    protected:
+        unsigned int num_tokens = 0;
+
+        /**
+         * Tokens not currently taken. Taken and returned without locking.
+         */
+        std::atomic<int> available{0};
+
+        /**
+         * Number of threads blocked in acquire(). Lets release() skip the mutex if there are none.
+         */
+        std::atomic<int> num_waiters{0};
+
+        /**
+         * A mutex for parking threads that wait for a token.
+         */
+        std::mutex mutex;
+
+        /**
+         * Used to notify a parked thread of a returned token.
+         */
+        std::condition_variable token_cv;
+    };
+
+    /**
+     * A process-wide CPU budget with one token per core, for pools from different libraries to share.
+     *
+     * The arbiter is created on first call and never destroyed, so that pools destroyed at exit may still use it.
+     *
+     * @return The shared arbiter.
+     */
+    inline cpu_arbiter& global_cpu_arbiter() {
+        static cpu_arbiter* arbiter = new cpu_arbiter();
+        return *arbiter;
+    }
+
+    /**
+     * Cancels one task submitted with submit_cancellable() or submit_detach_cancellable().
+     */
+    class cancellation_handle {
+    public:
+        cancellation_handle() = default;
+
+        /**
+         * Used by the pool.
+         */
+        explicit cancellation_handle(std::shared_ptr<detail::cancellable_state_base> state) : state(std::move(state)) {}
+
+        /**
+         * Prevent the task from starting. Takes constant time: the callable and anything it captured are destroyed
+         * immediately, its future fails with task_cancelled, and the queue entry is skipped by the worker that
+         * reaches it.
+         *
+         * @return true if the task was cancelled, false if it had already started or been cancelled.
+         */
+        bool cancel() {
+            return state && state->cancel();
+        }
+
+        /**
+         * @return true if the handle refers to a task.
+         */
+        TTP_NODISCARD bool valid() const noexcept {
+            return state != nullptr;
+        }
+
+    protected:
+        std::shared_ptr<detail::cancellable_state_base> state;
+    };
+
+    /**
+     * An event source, such as an epoll set, that a task_thread_pool's idle workers poll. See set_idle_poller().
+     */
+    class idle_poller {
+    public:
+        virtual ~idle_poller() = default;
+
+        /**
+         * Block until events arrive or wake() is called, then handle the events, if any.
+         * Called by an idle worker thread. Only one worker polls at a time.
+         */
+        virtual void poll() = 0;
+
+        /**
+         * Make a blocked or upcoming call to poll() return promptly. May be called from any thread.
+         */
+        virtual void wake() = 0;
+    };
+
+    namespace detail {
+        /**
+         * An entry in a pool's task queue.
+         */
+        template <typename Task>
+        struct queued_task {
+            template <typename F>
+            queued_task(F&& func, std::chrono::steady_clock::time_point enqueue_time, bool droppable, const char* label,
+                        const cancellable_state_base* cancel_state)
+                : task(std::forward<F>(func)), enqueue_time(enqueue_time), droppable(droppable), label(label),
+                  cancel_state(cancel_state) {}
+
+            Task task;
+
+            /**
+             * When the task was submitted. Only recorded while admission control is enabled, otherwise zero.
+             */
+            std::chrono::steady_clock::time_point enqueue_time;
+
+            /**
+             * The task may be shed by admission control. See submit_detach_droppable().
+             */
+            bool droppable;
+
+            /**
+             * Passed to the task hooks and probes. See submit_labeled(). May be null.
+             */
+            const char* label;
+
+            /**
+             * The state of a cancellable task, kept alive by the task itself, so that workers can skip the task
+             * once cancelled. Null for other tasks.
+             */
+            const cancellable_state_base* cancel_state;
+        };
+
+        struct queue_policy_tag {};
+        struct idle_policy_tag {};
+        struct storage_policy_tag {};
+        struct counting_policy_tag {};
+
+        /**
+         * Find the policy for one category in a basic_task_thread_pool's policy list.
+         *
+         * @tparam Tag The category's tag type.
+         * @tparam Default The policy to use if none in the list has the tag.
+         */
+        template <typename Tag, typename Default, typename... Policies>
+        struct select_policy {
+            using type = Default;
+        };
+
+        template <typename Tag, typename Default, typename Policy, typename... Rest>
+        struct select_policy<Tag, Default, Policy, Rest...> {
+            using type = typename std::conditional<std::is_same<typename Policy::policy_tag, Tag>::value,
+                Policy, typename select_policy<Tag, Default, Rest...>::type>::type;
+        };
+
+        /**
+         * A std::stack with the std::queue interface that the pool uses.
+         */
+        template <typename T, typename Allocator>
+        class lifo_adapter : public std::stack<T, std::deque<T, Allocator>> {
+        public:
+            T& front() {
+                return this->top();
+            }
+        };
+
+        /**
+         * Counts tasks that are in progress.
+         */
+        template <bool Enabled>
+        struct task_counter {
+            int count = 0;
+
+            void increment() { ++count; }
+            void decrement() { --count; }
+            TTP_NODISCARD int get() const { return count; }
+        };
+
+        /**
+         * A counter that is compiled out.
+         */
+        template <>
+        struct task_counter<false> {
+            void increment() {}
+            void decrement() {}
+            TTP_NODISCARD int get() const { return 0; }
+        };
+    }
+
+    /**
+     * Queue policy: run tasks in the order they were submitted. The default.
+     */
+    struct fifo_queue {
+        using policy_tag = detail::queue_policy_tag;
+
+        template <typename T, typename Allocator>
+        using container = std::queue<T, std::deque<T, Allocator>>;
+    };
+
+    /**
+     * Queue policy: run the most recently submitted task first. Its data is more likely to still be in cache,
+     * but early tasks may wait a long time under load.
+     */
+    struct lifo_queue {
+        using policy_tag = detail::queue_policy_tag;
+
+        template <typename T, typename Allocator>
+        using container = detail::lifo_adapter<T, Allocator>;
+    };
+
+    /**
+     * Idle policy: idle workers sleep on a condition variable until a task arrives. The default.
+     */
+    struct block_when_idle {
+        using policy_tag = detail::idle_policy_tag;
+
+        /**
+         * @param lock Held on entry and on return.
+         * @param cv Notified by notify_one() or notify_all() when ready() may have become true.
+         * @param epoch Passed to notify_one() and notify_all(). Unused by this policy.
+         * @param ready Checked with the lock held.
+         */
+        template <typename Predicate>
+        static void wait(std::unique_lock<std::mutex>& lock, std::condition_variable& cv,
+                         const std::atomic<unsigned int>& epoch, Predicate ready) {
+            (void)epoch;
+            cv.wait(lock, ready);
+        }
+
+        /**
+         * Wake one waiting worker. Called with the lock held.
+         */
+        static void notify_one(std::condition_variable& cv, std::atomic<unsigned int>& epoch) {
+            (void)epoch;
+            cv.notify_one();
+        }
+
+        /**
+         * Wake all waiting workers. Called with the lock held.
+         */
+        static void notify_all(std::condition_variable& cv, std::atomic<unsigned int>& epoch) {
+            (void)epoch;
+            cv.notify_all();
+        }
+    };
+
+    /**
+     * Idle policy: idle workers briefly poll the queue before sleeping. Lowers the latency of tasks submitted in
+     * quick succession, at the cost of CPU time burned by idle workers.
+     *
+     * Spinning workers watch an atomic counter that notify_one() and notify_all() bump, and only take the lock
+     * when it moves, so they do not contend with submitting threads. Pools with other idle policies never touch
+     * the counter.
+     *
+     * @tparam SpinCount How many times to check the counter before sleeping.
+     */
+    template <unsigned int SpinCount = 1000>
+    struct spin_then_block {
+        using policy_tag = detail::idle_policy_tag;
+
+        /**
+         * See block_when_idle::wait().
+         */
+        template <typename Predicate>
+        static void wait(std::unique_lock<std::mutex>& lock, std::condition_variable& cv,
+                         const std::atomic<unsigned int>& epoch, Predicate ready) {
+            unsigned int spins = 0;
+            while (!ready()) {
+                if (spins >= SpinCount) {
+                    cv.wait(lock, ready);
+                    return;
+                }
+
+                const unsigned int seen = epoch.load(std::memory_order_acquire);
+                lock.unlock();
+                while (spins < SpinCount && epoch.load(std::memory_order_acquire) == seen) {
+                    ++spins;
+                    std::this_thread::yield();
+                }
+                lock.lock();
+            }
+        }
+
+        /**
+         * Bump the epoch so that spinning workers look again, then wake one sleeping worker.
+         */
+        static void notify_one(std::condition_variable& cv, std::atomic<unsigned int>& epoch) {
+            epoch.fetch_add(1, std::memory_order_release);
+            cv.notify_one();
+        }
+
+        static void notify_all(std::condition_variable& cv, std::atomic<unsigned int>& epoch) {
+            epoch.fetch_add(1, std::memory_order_release);
+            cv.notify_all();
+        }
+    };
+
+    /**
+     * Storage policy: how many bytes of a task's callable, including any bound arguments and for submit() the
+     * std::promise, are stored directly in the task queue. Larger callables are allocated separately.
+     *
+     * @tparam InlineSize Size of the inline storage in bytes. At least sizeof(void*).
+     */
+    template <size_t InlineSize>
+    struct task_storage {
+        using policy_tag = detail::storage_policy_tag;
+
+        static constexpr size_t inline_size = InlineSize;
+    };
+
+    /**
+     * Counting policy: whether the pool counts in-progress tasks. The count is required by wait_for_tasks(),
+     * get_num_running_tasks(), and get_num_tasks(). Enabled by default.
+     *
+     * @tparam Enabled If false then the counter is compiled out and the above methods do not compile.
+     */
+    template <bool Enabled>
+    struct task_counting {
+        using policy_tag = detail::counting_policy_tag;
+
+        static constexpr bool enabled = Enabled;
+    };
+
+    /**
+     * A fast and lightweight thread pool that uses C++11 threads.
+     *
+     * Most users want the task_thread_pool alias, which uses the default policies. Other trade-offs can be chosen
+     * at compile time by listing policies, in any order, one per category:
+     *
+     *  - Queue order: fifo_queue (default) or lifo_queue.
+     *  - Idle workers: block_when_idle (default) or spin_then_block.
+     *  - Inline task storage: task_storage<6 * sizeof(void*)> (default) or another size.
+     *  - Task counting: task_counting<true> (default) or task_counting<false>.
+     *
+     * For example, `basic_task_thread_pool<lifo_queue, task_counting<false>>`.
+     *
+     * @tparam Policies Policies that replace the defaults.
+     */
+    template <typename... Policies>
+    class basic_task_thread_pool {
+    protected:
+        using queue_policy = typename detail::select_policy<detail::queue_policy_tag, fifo_queue, Policies...>::type;
+        using idle_policy = typename detail::select_policy<detail::idle_policy_tag, block_when_idle, Policies...>::type;
+        using storage_policy = typename detail::select_policy<
+            detail::storage_policy_tag, task_storage<6 * sizeof(void*)>, Policies...>::type;
+        using counting_policy = typename detail::select_policy<
+            detail::counting_policy_tag, task_counting<true>, Policies...>::type;
+
+        using task_type = detail::basic_task<storage_policy::inline_size>;
+
+    public:
+        /**
+         * Create a task_thread_pool and start worker threads.
+         *
+         * @param num_threads Number of worker threads. If 0 then number of threads is equal to the
+         *                    number of physical cores on the machine, as given by std::thread::hardware_concurrency().
+         */
+        explicit basic_task_thread_pool(unsigned int num_threads = 0) {
+            if (num_threads < 1) {
+                num_threads = std::thread::hardware_concurrency();
+                if (num_threads < 1) { num_threads = 1; }
+            }
+            max_compensating_threads = num_threads;
+            start_threads(num_threads);
+        }
+
+        /**
+         * Create a task_thread_pool but do not start worker threads until the first task is submitted.
+         * A pool that never receives a task never starts any threads.
+         *
+         * @param num_threads Number of worker threads. If 0 then number of threads is equal to the
+         *                    number of physical cores on the machine, as given by std::thread::hardware_concurrency().
+         */
+        basic_task_thread_pool(unsigned int num_threads, deferred_start_t) {
+            if (num_threads < 1) {
+                num_threads = std::thread::hardware_concurrency();
+                if (num_threads < 1) { num_threads = 1; }
+            }
+            max_compensating_threads = num_threads;
+            num_deferred_threads = num_threads;
+            threads_deferred = true;
+        }
+
+        /**
+         * Finish all tasks left in the queue then shut down worker threads.
+         * If the pool is currently paused then it is resumed.
+         */
+        ~basic_task_thread_pool() {
+            unpause();
+            wait_for_queued_tasks();
+            stop_all_threads();
+        }
+
+        /**
+         * Drop all tasks that have been submitted but not yet started by a worker.
+         *
+         * Tasks already in progress continue executing.
+         */
+        void clear_task_queue() {
+            // The dropped tasks are destroyed after task_mutex is released, so their destructors may submit tasks.
+            decltype(tasks) dropped_tasks;
+            decltype(deadline_tasks) dropped_deadline_tasks;
+            {
+                const std::lock_guard<std::mutex> tasks_lock(task_mutex);
+                std::swap(tasks, dropped_tasks);
+                std::swap(deadline_tasks, dropped_deadline_tasks);
+            }
+        }
+
+        /**
+         * Get number of enqueued tasks.
+         *
+         * @return Number of tasks that have been enqueued but not yet started.
+         */
+        TTP_NODISCARD size_t get_num_queued_tasks() const {
+            const std::lock_guard<std::mutex> tasks_lock(task_mutex);
+            return tasks.size() + deadline_tasks.size();
+        }
+
+        /**
+         * Get number of in-progress tasks.
+         *
+         * @return Approximate number of tasks currently being processed by worker threads.
+         */
+        TTP_NODISCARD size_t get_num_running_tasks() const {
+            static_assert(counting_policy::enabled, "requires task_counting<true>");
+            const std::lock_guard<std::mutex> tasks_lock(task_mutex);
+            return num_inflight_tasks.get();
+        }
+
+        /**
+         * Get total number of tasks in the pool.
+         *
+         * @return Approximate number of tasks both enqueued and running.
+         */
+        TTP_NODISCARD size_t get_num_tasks() const {
+            static_assert(counting_policy::enabled, "requires task_counting<true>");
+            const std::lock_guard<std::mutex> tasks_lock(task_mutex);
+            return tasks.size() + deadline_tasks.size() + num_inflight_tasks.get();
+        }
+
+        /**
+         * Get number of worker threads.
+         *
+         * @return Number of worker threads.
+         */
+        TTP_NODISCARD unsigned int get_num_threads() const {
+            const std::lock_guard<std::recursive_mutex> threads_lock(thread_mutex);
+            return static_cast<unsigned int>(threads.size()) + num_deferred_threads;
+        }
+
+        /**
+         * Set number of worker threads. Will start or stop worker threads as necessary.
+         *
+         * @param num_threads Number of worker threads. If 0 then number of threads is equal to the
+         *                    number of physical cores on the machine, as given by std::thread::hardware_concurrency().
+         * @return Previous number of worker threads.
+         */
+        unsigned int set_num_threads(unsigned int num_threads) {
+            const std::lock_guard<std::recursive_mutex> threads_lock(thread_mutex);
+            unsigned int previous_num_threads = get_num_threads();
+
+            if (num_threads < 1) {
+                num_threads = std::thread::hardware_concurrency();
+                if (num_threads < 1) { num_threads = 1; }
+            }
+
+            if (num_deferred_threads > 0) {
+                // threads have not been started yet
+                num_deferred_threads = num_threads;
+            } else if (previous_num_threads <= num_threads) {
+                // expanding the thread pool
+                start_threads(num_threads - previous_num_threads);
+            } else {
+                // contracting the thread pool
+                stop_all_threads();
+                {
+                    const std::lock_guard<std::mutex> tasks_lock(task_mutex);
+                    pool_running = true;
+                }
+                start_threads(num_threads);
+            }
+
+            return previous_num_threads;
+        }
+
+        /**
+         * Stop executing queued tasks. Use `unpause()` to resume. Note: Destroying the pool will implicitly unpause.
+         *
+         * Any in-progress tasks continue executing.
+         */
+        void pause() {
+            const std::lock_guard<std::mutex> tasks_lock(task_mutex);
+            pool_paused = true;
+        }
+
+        /**
+         * Resume executing queued tasks.
          */
         void unpause() {
             const std::lock_guard<std::mutex> tasks_lock(task_mutex);
-            pool_paused = false;
-            task_cv.notify_all();
+            pool_paused = false;
+            idle_policy::notify_all(task_cv, task_epoch);
+            if (polling_poller) {
+                polling_poller->wake();
+            }
+        }
+
+        /**
+         * Check whether the pool is paused.
+         *
+         * @return true if pause() has been called without an intervening unpause().
+         */
+        TTP_NODISCARD bool is_paused() const {
+            const std::lock_guard<std::mutex> tasks_lock(task_mutex);
+            return pool_paused;
+        }
+
+        /**
+         * Push back on submitters when tasks wait too long in the queue, using the CoDel algorithm.
+         *
+         * The pool measures each task's sojourn time, from submission until a worker starts it. Once sojourn times
+         * have stayed above target for a full interval, the pool is overloaded: try_submit() and try_submit_detach()
+         * reject new tasks, and tasks submitted with submit_detach_droppable() are dropped instead of run.
+         * The overload ends when a task's sojourn time drops below target or the queue empties.
+         * Other submit methods always enqueue.
+         *
+         * @param target Acceptable sojourn time. Zero disables admission control, which is the default.
+         * @param interval How long sojourn times must stay above target before the pool is overloaded.
+         *                 Should be on the order of a worst-case task duration.
+         */
+        void set_admission_control(std::chrono::steady_clock::duration target,
+                                   std::chrono::steady_clock::duration interval = std::chrono::milliseconds(100)) {
+            const std::lock_guard<std::mutex> tasks_lock(task_mutex);
+            admission_target = target;
+            admission_interval = interval;
+            first_above_target_time = {};
+            overloaded = false;
+        }
+
+        /**
+         * Check whether admission control considers the pool overloaded. See set_admission_control().
+         *
+         * @return true if try_submit() would currently reject a task.
+         */
+        TTP_NODISCARD bool is_overloaded() const {
+            return overloaded.load(std::memory_order_relaxed);
+        }
+
+        /**
+         * @return Number of tasks rejected by try_submit() and try_submit_detach().
+         */
+        TTP_NODISCARD size_t get_num_rejected_tasks() const {
+            return num_rejected_tasks.load(std::memory_order_relaxed);
+        }
+
+        /**
+         * @return Number of tasks submitted with submit_detach_droppable() that were dropped instead of run.
+         */
+        TTP_NODISCARD size_t get_num_shed_tasks() const {
+            const std::lock_guard<std::mutex> tasks_lock(task_mutex);
+            return num_shed_tasks;
+        }
+
+        /**
+         * Let idle worker threads poll an event source instead of sleeping, so that events such as I/O completions
+         * are handled directly on a worker without a handoff from a separate event loop thread.
+         *
+         * At most one worker polls at a time. Submitting a task while every other worker is busy wakes the poller
+         * so that it runs the task. Event handlers are not tasks: they are not counted by get_num_tasks() or
+         * waited for by wait_for_tasks().
+         *
+         * If the pool has deferred threads then they are started. Must not be called from inside idle_poller::poll().
+         *
+         * @param new_poller The event source, or nullptr to stop polling. Must stay alive until it is replaced.
+         *                   Blocks until no worker is inside the previous poller's poll().
+         */
+        void set_idle_poller(idle_poller* new_poller) {
+            if (threads_deferred.load(std::memory_order_acquire)) {
+                start_deferred_threads();
+            }
+
+            std::unique_lock<std::mutex> tasks_lock(task_mutex);
+            idle_poller* old_poller = poller;
+            poller = new_poller;
+            idle_policy::notify_one(task_cv, task_epoch);
+
+            if (old_poller && polling_poller == old_poller) {
+                old_poller->wake();
+                task_finished_cv.wait(tasks_lock, [&] { return polling_poller != old_poller; });
+            }
+        }
+
+        /**
+         * Give each worker thread a context object, such as scratch buffers, a random number generator, or an
+         * allocator arena, that tasks can reuse without locking. Tasks submitted with submit_with_context() are
+         * passed the context. Other tasks may use current_worker_context().
+         *
+         * The factory runs once on each worker thread when the thread starts, and the context is destroyed on
+         * the same thread when it stops. If worker threads are already running then they are restarted after
+         * finishing their current tasks, so do not call from a task; it would wait for itself to finish.
+         *
+         * @tparam T The type of the context.
+         * @param factory Called with the worker's index, or no_worker_index for a compensating thread. Must not throw.
+         *                Pass nullptr to remove contexts.
+         */
+        template <typename T>
+        void set_worker_context(std::function<std::shared_ptr<T>(unsigned int)> factory) {
+            worker_context_factory erased;
+            if (factory) {
+                erased = [factory](unsigned int index) -> std::shared_ptr<void> { return factory(index); };
+            }
+
+            const std::lock_guard<std::recursive_mutex> threads_lock(thread_mutex);
+            {
+                const std::lock_guard<std::mutex> tasks_lock(task_mutex);
+                context_factory = std::move(erased);
+                context_type = detail::type_tag<T>();
+            }
+
+            if (!threads.empty()) {
+                const auto num_threads = static_cast<unsigned int>(threads.size());
+                stop_all_threads();
+                {
+                    const std::lock_guard<std::mutex> tasks_lock(task_mutex);
+                    pool_running = true;
+                }
+                start_threads(num_threads);
+            }
+        }
+
+        /**
+         * Run callbacks on the worker thread immediately before and after each task, for example to attribute
+         * CPU time or allocations to tasks. The callbacks may use current_worker_index().
+         *
+         * Both callbacks receive the task's label, given to submit_labeled() or submit_detach_labeled(), or null.
+         *
+         * @param before Called before each task. Must not throw. May be empty.
+         * @param after Called after each task, even if the task threw. Must not throw. May be empty.
+         */
+        void set_task_hooks(std::function<void(const char* label)> before,
+                            std::function<void(const char* label)> after) {
+            std::shared_ptr<const detail::task_hooks> hooks;
+            if (before || after) {
+                hooks = std::make_shared<const detail::task_hooks>(detail::task_hooks{std::move(before), std::move(after)});
+            }
+            const std::lock_guard<std::mutex> tasks_lock(task_mutex);
+            task_hooks = std::move(hooks);
+        }
+
+        /**
+         * Name the worker threads, so that debuggers, top, and profilers can tell pools apart.
+         * Workers are named "name-index" and compensating threads "name-c", shortened to 15 characters.
+         * Only supported on Linux and macOS.
+         *
+         * On Linux running threads are renamed in place. On macOS running worker threads are restarted after
+         * finishing their current tasks, so do not call from a task.
+         *
+         * @param new_name The name prefix. Empty leaves threads started afterwards unnamed, which is the default.
+         */
+        void set_name(const std::string& new_name) {
+            const std::lock_guard<std::recursive_mutex> threads_lock(thread_mutex);
+#if defined(__linux__)
+            // Threads name themselves at start with task_mutex held, so none can miss the new name.
+            const std::lock_guard<std::mutex> tasks_lock(task_mutex);
+            name = new_name;
+            if (!name.empty()) {
+                for (unsigned int index = 0; index < threads.size(); ++index) {
+                    detail::name_thread(threads[index], name, "-" + std::to_string(index));
+                }
+                for (auto& thread : compensating_threads) {
+                    detail::name_thread(thread, name, "-c");
+                }
+            }
+#else
+            {
+                const std::lock_guard<std::mutex> tasks_lock(task_mutex);
+                name = new_name;
+            }
+
+            if (!threads.empty()) {
+                const auto num_threads = static_cast<unsigned int>(threads.size());
+                stop_all_threads();
+                {
+                    const std::lock_guard<std::mutex> tasks_lock(task_mutex);
+                    pool_running = true;
+                }
+                start_threads(num_threads);
+            }
+#endif
+        }
+
+        /**
+         * @return The name set with set_name().
+         */
+        TTP_NODISCARD std::string get_name() const {
+            const std::lock_guard<std::mutex> tasks_lock(task_mutex);
+            return name;
+        }
+
+        /**
+         * Get the maximum number of compensating threads that may be started for tasks in a blocking_scope.
+         *
+         * @return Maximum number of compensating threads.
+         */
+        TTP_NODISCARD unsigned int get_max_compensating_threads() const {
+            const std::lock_guard<std::mutex> tasks_lock(task_mutex);
+            return max_compensating_threads;
+        }
+
+        /**
+         * Set the maximum number of compensating threads that may be started for tasks in a blocking_scope.
+         * Defaults to the number of threads the pool was constructed with. Lowering the limit takes effect when
+         * compensating threads finish their current task.
+         *
+         * @param num_threads Maximum number of compensating threads. 0 disables compensation.
+         */
+        void set_max_compensating_threads(unsigned int num_threads) {
+            const std::lock_guard<std::mutex> tasks_lock(task_mutex);
+            max_compensating_threads = num_threads;
+        }
+
+        /**
+         * Share a CPU budget with other pools. Each task then holds one of the arbiter's tokens while it runs.
+         *
+         * Tasks that block on work in another pool sharing the arbiter, such as waiting on its futures, must do so
+         * inside a blocking_scope, which returns the token while blocked. Otherwise the pools may deadlock.
+         *
+         * @param new_arbiter The arbiter, such as global_cpu_arbiter(), or nullptr to not use one, which is the
+         *                    default. Applies to tasks started afterwards. Must outlive the pool.
+         */
+        void set_cpu_arbiter(cpu_arbiter* new_arbiter) {
+            const std::lock_guard<std::mutex> tasks_lock(task_mutex);
+            arbiter = new_arbiter;
+        }
+
+        /**
+         * @return The arbiter set with set_cpu_arbiter(), or nullptr.
+         */
+        TTP_NODISCARD cpu_arbiter* get_cpu_arbiter() const {
+            const std::lock_guard<std::mutex> tasks_lock(task_mutex);
+            return arbiter;
+        }
+
+        /**
+         * Submit a Callable for the pool to execute and return a std::future.
+         *
+         * @param func The Callable to execute. Can be a function, a lambda, std::packaged_task, std::function, etc.
+         * @param args Arguments for func. Optional.
+         * @return std::future that can be used to get func's return value or thrown exception.
+         */
+        template <typename F, typename... A,
+            typename R = detail::invoke_result_t<decay_t<F>, decay_t<A>...>>
+        TTP_NODISCARD std::future<R> submit(F&& func, A&&... args) {
+            return submit_labeled(nullptr, std::forward<F>(func), std::forward<A>(args)...);
+        }
+
+        /**
+         * Submit a Callable for the pool to execute and return a std::future. The label is passed to the task hooks
+         * and the task_start and task_finish probes, to attribute time to kinds of tasks. See set_task_hooks().
+         *
+         * @param label The task's label. Must outlive the task, such as a string literal.
+         * @param func The Callable to execute. Can be a function, a lambda, std::packaged_task, std::function, etc.
+         * @param args Arguments for func. Optional.
+         * @return std::future that can be used to get func's return value or thrown exception.
+         */
+        template <typename F, typename... A,
+            typename R = detail::invoke_result_t<decay_t<F>, decay_t<A>...>>
+        TTP_NODISCARD std::future<R> submit_labeled(const char* label, F&& func, A&&... args) {
+            auto task = detail::make_promise_task<R>(std::forward<F>(func), std::forward<A>(args)...);
+            auto ret = task.promise.get_future();
+            enqueue(std::move(task), false, label);
+            return ret;
+        }
+
+        /**
+         * Submit a Callable that is passed the context of the worker that runs it, given to set_worker_context().
+         *
+         * @tparam T The type of the context. If the worker has no context of this type then the future fails
+         *           with std::logic_error.
+         * @param func The Callable to execute. Called with a T& followed by args.
+         * @param args Arguments for func. Optional.
+         * @return std::future that can be used to get func's return value or thrown exception.
+         */
+        template <typename T, typename F, typename... A,
+            typename R = detail::invoke_result_t<decay_t<F>, T&, decay_t<A>...>>
+        TTP_NODISCARD std::future<R> submit_with_context(F&& func, A&&... args) {
+            using bound_type = decltype(std::bind(std::forward<F>(func), std::placeholders::_1,
+                                                  std::forward<A>(args)...));
+            detail::context_promise_task<R, T, bound_type> task{
+                std::promise<R>(std::allocator_arg, detail::recycling_allocator<char>()),
+                std::bind(std::forward<F>(func), std::placeholders::_1, std::forward<A>(args)...)};
+            auto ret = task.promise.get_future();
+            enqueue(std::move(task), false);
+            return ret;
+        }
+
+        /**
+         * Submit a Callable that is passed the context of the worker that runs it, given to set_worker_context().
+         * Skipped if the worker has no context of type T.
+         *
+         * @tparam T The type of the context.
+         * @param func The Callable to execute. Called with a T& followed by args.
+         * @param args Arguments for func. Optional.
+         */
+        template <typename T, typename F, typename... A>
+        void submit_detach_with_context(F&& func, A&&... args) {
+            using bound_type = decltype(std::bind(std::forward<F>(func), std::placeholders::_1,
+                                                  std::forward<A>(args)...));
+            enqueue(detail::context_task<T, bound_type>{
+                std::bind(std::forward<F>(func), std::placeholders::_1, std::forward<A>(args)...)}, false);
+        }
+
+        /**
+         * Submit a Callable that is only worth running if it starts by a deadline, such as a request handler
+         * whose client times out.
+         *
+         * Tasks with a deadline run before other queued tasks, earliest deadline first. So that a steady stream of
+         * them cannot starve other tasks, one task without a deadline runs after every 8 in a row. A task that has not
+         * started by its deadline is skipped without taking a worker, and its future fails with task_expired.
+         * See get_num_expired_tasks().
+         *
+         * @param deadline When the task expires.
+         * @param func The Callable to execute. Can be a function, a lambda, std::packaged_task, std::function, etc.
+         * @param args Arguments for func. Optional.
+         * @return std::future that can be used to get func's return value or thrown exception.
+         */
+        template <typename F, typename... A,
+            typename R = detail::invoke_result_t<decay_t<F>, decay_t<A>...>>
+        TTP_NODISCARD std::future<R> submit_with_deadline(std::chrono::steady_clock::time_point deadline,
+                                                          F&& func, A&&... args) {
+            detail::deadline_promise_task<R, detail::bound_t<F, A...>> task{
+                detail::make_promise_task<R>(std::forward<F>(func), std::forward<A>(args)...), deadline,
+                &num_expired_tasks};
+            auto ret = task.task.promise.get_future();
+            enqueue_with_deadline(deadline, std::move(task));
+            return ret;
+        }
+
+        /**
+         * @return Number of tasks submitted with submit_with_deadline() that were skipped because they expired.
+         */
+        TTP_NODISCARD size_t get_num_expired_tasks() const {
+            return num_expired_tasks.load(std::memory_order_relaxed);
+        }
+
+        /**
+         * Submit a Callable for the pool to execute that can be cancelled until it starts.
+         *
+         * @param func The Callable to execute. Can be a function, a lambda, std::packaged_task, std::function, etc.
+         * @param args Arguments for func. Optional.
+         * @return std::future for func's result, and a handle to cancel the task. A cancelled task's future fails
+         *         with task_cancelled.
+         */
+        template <typename F, typename... A,
+            typename R = detail::invoke_result_t<decay_t<F>, decay_t<A>...>>
+        TTP_NODISCARD std::pair<std::future<R>, cancellation_handle> submit_cancellable(F&& func, A&&... args) {
+            auto task = detail::make_promise_task<R>(std::forward<F>(func), std::forward<A>(args)...);
+            auto ret = task.promise.get_future();
+            return std::make_pair(std::move(ret), enqueue_cancellable(std::move(task)));
+        }
+
+        /**
+         * Submit a Callable for the pool to execute that can be cancelled until it starts.
+         *
+         * @param func The Callable to execute. Can be a function, a lambda, std::packaged_task, std::function, etc.
+         * @param args Arguments for func. Optional.
+         * @return A handle to cancel the task.
+         */
+        template <typename F, typename... A>
+        cancellation_handle submit_detach_cancellable(F&& func, A&&... args) {
+            return enqueue_cancellable(std::bind(std::forward<F>(func), std::forward<A>(args)...));
+        }
+
+        /**
+         * Submit a zero-argument Callable for the pool to execute.
+         *
+         * @param func The Callable to execute. Can be a function, a lambda, std::packaged_task, std::function, etc.
+         */
+        template <typename F>
+        void submit_detach(F&& func) {
+            enqueue(std::forward<F>(func), false);
+        }
+
+        /**
+         * Submit a Callable with arguments for the pool to execute.
+         *
+         * @param func The Callable to execute. Can be a function, a lambda, std::packaged_task, std::function, etc.
+         */
+        template <typename F, typename... A>
+        void submit_detach(F&& func, A&&... args) {
+            enqueue(std::bind(std::forward<F>(func), std::forward<A>(args)...), false);
+        }
+
+        /**
+         * Submit a Callable with optional arguments for the pool to execute. The label is passed to the task hooks
+         * and the task_start and task_finish probes. See submit_labeled().
+         *
+         * @param label The task's label. Must outlive the task, such as a string literal.
+         * @param func The Callable to execute. Can be a function, a lambda, std::packaged_task, std::function, etc.
+         * @param args Arguments for func. Optional.
+         */
+        template <typename F, typename... A>
+        void submit_detach_labeled(const char* label, F&& func, A&&... args) {
+            enqueue(std::bind(std::forward<F>(func), std::forward<A>(args)...), false, label);
+        }
+
+        /**
+         * Submit a Callable for the pool to execute, unless admission control considers the pool overloaded.
+         * See set_admission_control().
+         *
+         * @param func The Callable to execute. Can be a function, a lambda, std::packaged_task, std::function, etc.
+         * @param args Arguments for func. Optional.
+         * @return std::future for func's result, or an invalid std::future if the task was rejected.
+         */
+        template <typename F, typename... A,
+            typename R = detail::invoke_result_t<decay_t<F>, decay_t<A>...>>
+        TTP_NODISCARD std::future<R> try_submit(F&& func, A&&... args) {
+            if (reject_if_overloaded()) {
+                return std::future<R>();
+            }
+            return submit(std::forward<F>(func), std::forward<A>(args)...);
+        }
+
+        /**
+         * Submit a Callable for the pool to execute, unless admission control considers the pool overloaded.
+         * See set_admission_control().
+         *
+         * @param func The Callable to execute. Can be a function, a lambda, std::packaged_task, std::function, etc.
+         * @param args Arguments for func. Optional.
+         * @return true if the task was submitted, false if it was rejected.
+         */
+        template <typename F, typename... A>
+        bool try_submit_detach(F&& func, A&&... args) {
+            if (reject_if_overloaded()) {
+                return false;
+            }
+            submit_detach(std::forward<F>(func), std::forward<A>(args)...);
+            return true;
+        }
+
+        /**
+         * Submit a Callable that admission control may drop, without running it, if the pool becomes overloaded
+         * before the task starts. Use for work that is worthless once late, such as cache warming or speculative
+         * prefetches. See set_admission_control().
+         *
+         * @param func The Callable to execute. Can be a function, a lambda, std::packaged_task, std::function, etc.
+         * @param args Arguments for func. Optional.
+         */
+        template <typename F, typename... A>
+        void submit_detach_droppable(F&& func, A&&... args) {
+            enqueue(std::bind(std::forward<F>(func), std::forward<A>(args)...), true);
+        }
+
+        /**
+         * Block until the task queue is empty. Some tasks may be in-progress when this method returns.
+         */
+        void wait_for_queued_tasks() {
+            std::unique_lock<std::mutex> tasks_lock(task_mutex);
+            notify_task_finish = true;
+            task_finished_cv.wait(tasks_lock, [&] { return queue_empty(); });
+            notify_task_finish = false;
+        }
+
+        /**
+         * Block until all tasks have finished.
+         */
+        void wait_for_tasks() {
+            static_assert(counting_policy::enabled, "requires task_counting<true>");
+            std::unique_lock<std::mutex> tasks_lock(task_mutex);
+            notify_task_finish = true;
+            task_finished_cv.wait(tasks_lock, [&] { return queue_empty() && num_inflight_tasks.get() == 0; });
+            notify_task_finish = false;
+        }
+
+    protected:
+        friend class blocking_scope;
+
+        /**
+         * Add a task to the queue and wake a thread to run it.
+         */
+        template <typename F>
+        void enqueue(F&& func, bool droppable, const char* label = nullptr,
+                     const detail::cancellable_state_base* cancel_state = nullptr) {
+            if (threads_deferred.load(std::memory_order_acquire)) {
+                start_deferred_threads();
+            }
+            const std::lock_guard<std::mutex> tasks_lock(task_mutex);
+            tasks.emplace(std::forward<F>(func),
+                          admission_target.count() > 0 ? std::chrono::steady_clock::now()
+                                                       : std::chrono::steady_clock::time_point{},
+                          droppable, label, cancel_state);
+            TTP_PROBE(enqueue, this, tasks.size() + deadline_tasks.size());
+            notify_task_added();
+        }
+
+        /**
+         * Add a cancellable task to the queue.
+         *
+         * @return The task's cancellation handle.
+         */
+        template <typename Fn>
+        cancellation_handle enqueue_cancellable(Fn&& func) {
+            using state_type = detail::cancellable_state<typename std::decay<Fn>::type>;
+            std::shared_ptr<detail::cancellable_state_base> state =
+                std::allocate_shared<state_type>(detail::recycling_allocator<state_type>(), std::forward<Fn>(func));
+            enqueue(detail::cancellable_task_ref(state), false, nullptr, state.get());
+            return cancellation_handle(std::move(state));
+        }
+
+        /**
+         * Add a task to the deadline heap and wake a thread to run it.
+         */
+        void enqueue_with_deadline(std::chrono::steady_clock::time_point deadline, task_type task) {
+            if (threads_deferred.load(std::memory_order_acquire)) {
+                start_deferred_threads();
+            }
+            const std::lock_guard<std::mutex> tasks_lock(task_mutex);
+            deadline_tasks.push_back(detail::deadline_entry<task_type>{deadline, next_deadline_seq++, std::move(task)});
+            std::push_heap(deadline_tasks.begin(), deadline_tasks.end(), detail::later_deadline());
+            TTP_PROBE(enqueue, this, tasks.size() + deadline_tasks.size());
+            notify_task_added();
+        }
+
+        /**
+         * Wake a thread to run a newly added task.
+         *
+         * Must be called with task_mutex held.
+         */
+        void notify_task_added() {
+            idle_policy::notify_one(task_cv, task_epoch);
+            if (polling_poller && num_waiting_workers == 0) {
+                polling_poller->wake();
+            }
+            if (num_blocked_workers > 0) {
+                compensating_cv.notify_one();
+            }
+        }
+
+        /**
+         * Check whether both the task queue and the deadline heap are empty.
+         *
+         * Must be called with task_mutex held.
+         */
+        TTP_NODISCARD bool queue_empty() const {
+            return tasks.empty() && deadline_tasks.empty();
+        }
+
+        /**
+         * Count a rejected task if the pool is overloaded.
+         *
+         * @return true if the task should be rejected.
+         */
+        bool reject_if_overloaded() {
+            if (overloaded.load(std::memory_order_relaxed)) {
+                num_rejected_tasks.fetch_add(1, std::memory_order_relaxed);
+                return true;
+            }
+            return false;
+        }
+
+        /**
+         * Take a CPU token for the next task, if the pool uses a cpu_arbiter.
+         *
+         * Must be called with task_mutex held. Unlocks it while waiting for a token.
+         *
+         * @param runnable Whether the thread may still run a task, checked again after waiting.
+         * @return false if the thread may no longer run a task after waiting. No token is then held.
+         */
+        template <typename Predicate>
+        bool acquire_cpu_token(std::unique_lock<std::mutex>& tasks_lock, Predicate runnable) {
+            cpu_arbiter* token_arbiter = arbiter;
+            if (!token_arbiter) {
+                return true;
+            }
+
+            if (!token_arbiter->try_acquire()) {
+                tasks_lock.unlock();
+                const bool acquired = token_arbiter->acquire([&] { return !pool_running.load(); });
+                tasks_lock.lock();
+                if (!acquired) {
+                    // the pool is stopping
+                    return false;
+                }
+                if (!runnable()) {
+                    token_arbiter->release();
+                    return false;
+                }
+            }
+            detail::this_worker().token_arbiter = token_arbiter;
+            return true;
+        }
+
+        /**
+         * Return the current thread's CPU token, if it holds one.
+         */
+        static void release_cpu_token() {
+            cpu_arbiter*& token_arbiter = detail::this_worker().token_arbiter;
+            if (token_arbiter) {
+                token_arbiter->release();
+                token_arbiter = nullptr;
+            }
+        }
+
+        /**
+         * Fail expired tasks at the top of the deadline heap and drop cancelled tasks from the front of the queue,
+         * so that workers do not take a CPU token, count them in flight, or run the task hooks for them.
+         *
+         * Must be called with task_mutex held. Neither the expired tasks nor the tasks' destructors call back into
+         * the pool.
+         *
+         * @return true if the queue is then empty.
+         */
+        bool drop_stale_tasks() {
+            bool dropped = false;
+
+            if (!deadline_tasks.empty()) {
+                const auto now = std::chrono::steady_clock::now();
+                while (!deadline_tasks.empty() && now > deadline_tasks.front().deadline) {
+                    std::pop_heap(deadline_tasks.begin(), deadline_tasks.end(), detail::later_deadline());
+                    task_type expired = std::move(deadline_tasks.back().task);
+                    deadline_tasks.pop_back();
+                    // only fails the promise with task_expired. See deadline_promise_task.
+                    expired();
+                    dropped = true;
+                }
+            }
+
+            while (!tasks.empty() && tasks.front().cancel_state && tasks.front().cancel_state->is_cancelled()) {
+                tasks.pop();
+                dropped = true;
+            }
+
+            if (!dropped) {
+                return false;
+            }
+            TTP_PROBE(dequeue, this, tasks.size() + deadline_tasks.size());
+            if (tasks.empty()) {
+                first_above_target_time = {};
+                overloaded = false;
+            }
+            if (queue_empty()) {
+                if (notify_task_finish) {
+                    task_finished_cv.notify_all();
+                }
+                return true;
+            }
+            return false;
+        }
+
+        /**
+         * Pop the next task and update admission control. Tasks with a deadline go first, earliest deadline first,
+         * up to max_deadline_burst of them in a row while tasks without a deadline wait.
+         *
+         * Must be called with task_mutex held and queue_empty() false.
+         *
+         * @param task Set to the task.
+         * @param label Set to the task's label, or null.
+         * @return false if the task was shed or cancelled and must not be run.
+         */
+        bool pop_task(task_type& task, const char*& label) {
+            if (!deadline_tasks.empty() && (tasks.empty() || deadline_burst < detail::max_deadline_burst)) {
+                if (!tasks.empty()) {
+                    ++deadline_burst;
+                }
+                std::pop_heap(deadline_tasks.begin(), deadline_tasks.end(), detail::later_deadline());
+                task = std::move(deadline_tasks.back().task);
+                deadline_tasks.pop_back();
+                label = nullptr;
+                return true;
+            }
+
+            deadline_burst = 0;
+            auto& next = tasks.front();
+            bool run = true;
+
+            if (admission_target.count() > 0 && next.enqueue_time != std::chrono::steady_clock::time_point{}) {
+                // CoDel: overloaded once the minimum sojourn time has stayed above target for a full interval
+                const auto now = std::chrono::steady_clock::now();
+                if (now - next.enqueue_time < admission_target) {
+                    first_above_target_time = {};
+                    overloaded = false;
+                } else if (first_above_target_time == std::chrono::steady_clock::time_point{}) {
+                    first_above_target_time = now + admission_interval;
+                } else if (now >= first_above_target_time) {
+                    overloaded = true;
+                }
+
+                if (next.droppable && overloaded.load(std::memory_order_relaxed)) {
+                    ++num_shed_tasks;
+                    run = false;
+                }
+            }
+
+            if (next.cancel_state && next.cancel_state->is_cancelled()) {
+                // cancelled after drop_stale_tasks() looked
+                run = false;
+            }
+
+            task = std::move(next.task);
+            label = next.label;
+            tasks.pop();
+
+            if (tasks.empty()) {
+                first_above_target_time = {};
+                overloaded = false;
+            }
+            return run;
         }
 
-        /**
-         * Check whether the pool is paused.
-         *
-         * @return true if pause() has been called without an intervening unpause().
-         */
-        TTP_NODISCARD bool is_paused() const {
-            const std::lock_guard<std::mutex> tasks_lock(task_mutex);
-            return pool_paused;
-        }
+        /**
+         * Main function for worker threads.
+         */
+        void worker_main(unsigned int index, const worker_context_factory& factory, const void* factory_type) {
+            name_this_worker("-" + std::to_string(index));
+
+            detail::worker_frame frame = {index, nullptr, nullptr};
+            std::shared_ptr<void> context;
+            if (factory) {
+                context = factory(index);
+                frame.context = context.get();
+                frame.context_type = factory_type;
+            }
+            detail::this_worker().frame = &frame;
+
+            bool finished_task = false;
+
+            while (true) {
+                std::unique_lock<std::mutex> tasks_lock(task_mutex);
+
+                if (finished_task) {
+                    num_inflight_tasks.decrement();
+                    if (notify_task_finish) {
+                        task_finished_cv.notify_all();
+                    }
+                    finished_task = false;
+                }
+
+                auto ready = [&]() {
+                    return !pool_running || (!pool_paused && !queue_empty()) || (poller && !polling_poller);
+                };
+                if (!ready()) {
+                    TTP_PROBE(park, this, index);
+                    ++num_waiting_workers;
+                    idle_policy::wait(tasks_lock, task_cv, task_epoch, ready);
+                    --num_waiting_workers;
+                    TTP_PROBE(wake, this, index);
+                }
+
+                if (!pool_running) {
+                    break;
+                }
+
+                if (pool_paused || queue_empty()) {
+                    // Nothing to run, so poll the idle_poller.
+                    idle_poller* active_poller = poller;
+                    polling_poller = active_poller;
+                    tasks_lock.unlock();
+
+                    try {
+                        active_poller->poll();
+                    } catch (...) {
+                        // An event handler threw. Nothing that the pool can do anything about.
+                    }
+
+                    tasks_lock.lock();
+                    polling_poller = nullptr;
+                    task_finished_cv.notify_all();
+                    continue;
+                }
+
+                // Must mean that (!pool_paused && !queue_empty()) is true
+
+                if (drop_stale_tasks()) {
+                    continue;
+                }
+
+                if (!acquire_cpu_token(tasks_lock, [&] { return pool_running && !pool_paused && !queue_empty(); })) {
+                    continue;
+                }
 
-        /**
-         * Submit a Callable for the pool to execute and return a std::future.
-         *
-         * @param func The Callable to execute. Can be a function, a lambda, std::packaged_task, std::function, etc.
-         * @param args Arguments for func. Optional.
-         * @return std::future that can be used to get func's return value or thrown exception.
-         */
-        template <typename F, typename... A,
-#if TTP_CXX17
-            typename R = std::invoke_result_t<std::decay_t<F>, std::decay_t<A>...>
-#else
-            typename R = typename std::result_of<decay_t<F>(decay_t<A>...)>::type
-#endif
-            >
-        TTP_NODISCARD std::future<R> submit(F&& func, A&&... args) {
-#if defined(_MSC_VER)
-            // MSVC's packaged_task is not movable even though it should be.
-            // Discussion about this bug and its future fix:
-            // https://developercommunity.visualstudio.com/t/unable-to-move-stdpackaged-task-into-any-stl-conta/108672
-            std::shared_ptr<std::packaged_task<R()>> ptask =
-                std::make_shared<std::packaged_task<R()>>(std::bind(std::forward<F>(func), std::forward<A>(args)...));
-            submit_detach([ptask] { (*ptask)(); });
-            return ptask->get_future();
-#else
-            std::packaged_task<R()> task(std::bind(std::forward<F>(func), std::forward<A>(args)...));
-            auto ret = task.get_future();
-            submit_detach(std::move(task));
-            return ret;
-#endif
-        }
+                task_type task;
+                const char* label = nullptr;
+                const bool run = pop_task(task, label);
+                num_inflight_tasks.increment();
+                TTP_PROBE(dequeue, this, tasks.size() + deadline_tasks.size());
+                std::shared_ptr<const detail::task_hooks> hooks = task_hooks;
+                tasks_lock.unlock();
 
-        /**
-         * Submit a zero-argument Callable for the pool to execute.
-         *
-         * @param func The Callable to execute. Can be a function, a lambda, std::packaged_task, std::function, etc.
-         */
-        template <typename F>
-        void submit_detach(F&& func) {
-            const std::lock_guard<std::mutex> tasks_lock(task_mutex);
-            tasks.emplace(std::forward<F>(func));
-            task_cv.notify_one();
+                if (run) {
+                    run_task(task, hooks.get(), frame, label);
+                }
+                release_cpu_token();
+
+                finished_task = true;
+            }
+
+            detail::this_worker() = detail::worker_info{};
         }
 
         /**
-         * Submit a Callable with arguments for the pool to execute.
-         *
-         * @param func The Callable to execute. Can be a function, a lambda, std::packaged_task, std::function, etc.
+         * Name the calling pool thread after the pool, if it has a name. See set_name().
          */
-        template <typename F, typename... A>
-        void submit_detach(F&& func, A&&... args) {
+        void name_this_worker(const std::string& suffix) {
             const std::lock_guard<std::mutex> tasks_lock(task_mutex);
-            tasks.emplace(std::bind(std::forward<F>(func), std::forward<A>(args)...));
-            task_cv.notify_one();
+            if (!name.empty()) {
+                detail::name_this_thread(name, suffix);
+            }
         }
 
         /**
-         * Block until the task queue is empty. Some tasks may be in-progress when this method returns.
+         * Run a task popped off the queue, with the task hooks, if any.
          */
-        void wait_for_queued_tasks() {
-            std::unique_lock<std::mutex> tasks_lock(task_mutex);
-            notify_task_finish = true;
-            task_finished_cv.wait(tasks_lock, [&] { return tasks.empty(); });
-            notify_task_finish = false;
+        void run_task(task_type& task, const detail::task_hooks* hooks, const detail::worker_frame& frame,
+                      const char* label) {
+            if (hooks && hooks->before) {
+                hooks->before(label);
+            }
+            TTP_PROBE3(task_start, this, frame.index, label);
+
+            try {
+                task(frame);
+            } catch (...) {
+                // Tasks submitted with submit_detach() may throw. Nothing that the pool can do anything about.
+            }
+
+            TTP_PROBE3(task_finish, this, frame.index, label);
+            if (hooks && hooks->after) {
+                hooks->after(label);
+            }
         }
 
         /**
-         * Block until all tasks have finished.
+         * Main function for compensating threads.
+         *
+         * Compensating threads only run tasks while some worker is inside a blocking_scope, and never run more tasks
+         * at once than there are such blocked workers. Otherwise they stay parked and can be woken for the next
+         * blocking_scope.
          */
-        void wait_for_tasks() {
-            std::unique_lock<std::mutex> tasks_lock(task_mutex);
-            notify_task_finish = true;
-            task_finished_cv.wait(tasks_lock, [&] { return tasks.empty() && num_inflight_tasks == 0; });
-            notify_task_finish = false;
-        }
+        void compensating_worker_main(const worker_context_factory& factory, const void* factory_type) {
+            name_this_worker("-c");
 
-    protected:
+            detail::worker_frame frame = {no_worker_index, nullptr, nullptr};
+            std::shared_ptr<void> context;
+            if (factory) {
+                context = factory(no_worker_index);
+                frame.context = context.get();
+                frame.context_type = factory_type;
+            }
+            detail::this_worker().frame = &frame;
 
-        /**
-         * Main function for worker threads.
-         */
-        void worker_main() {
             bool finished_task = false;
 
             while (true) {
                 std::unique_lock<std::mutex> tasks_lock(task_mutex);
 
                 if (finished_task) {
-                    --num_inflight_tasks;
+                    num_inflight_tasks.decrement();
+                    --num_running_compensating;
                     if (notify_task_finish) {
                         task_finished_cv.notify_all();
                     }
+                    finished_task = false;
                 }
 
-                task_cv.wait(tasks_lock, [&]() { return !pool_running || (!pool_paused && !tasks.empty()); });
+                auto runnable = [&]() {
+                    return !pool_paused && !queue_empty() && num_running_compensating < num_blocked_workers &&
+                        num_running_compensating < max_compensating_threads;
+                };
+                if (pool_running && !runnable()) {
+                    TTP_PROBE(park, this, no_worker_index);
+                    compensating_cv.wait(tasks_lock, [&]() { return !pool_running || runnable(); });
+                    TTP_PROBE(wake, this, no_worker_index);
+                }
 
                 if (!pool_running) {
                     break;
                 }
 
-                // Must mean that (!pool_paused && !tasks.empty()) is true
+                if (drop_stale_tasks()) {
+                    continue;
+                }
 
-                std::packaged_task<void()> task{std::move(tasks.front())};
-                tasks.pop();
-                ++num_inflight_tasks;
+                if (!acquire_cpu_token(tasks_lock, [&] { return pool_running && runnable(); })) {
+                    continue;
+                }
+
+                task_type task;
+                const char* label = nullptr;
+                const bool run = pop_task(task, label);
+                num_inflight_tasks.increment();
+                ++num_running_compensating;
+                TTP_PROBE(dequeue, this, tasks.size() + deadline_tasks.size());
+                std::shared_ptr<const detail::task_hooks> hooks = task_hooks;
                 tasks_lock.unlock();
 
-                try {
-                    task();
-                } catch (...) {
-                    // std::packaged_task::operator() may throw in some error conditions, such as if the task
-                    // had already been run. Nothing that the pool can do anything about.
+                if (run) {
+                    run_task(task, hooks.get(), frame, label);
                 }
+                release_cpu_token();
 
                 finished_task = true;
             }
+
+            detail::this_worker() = detail::worker_info{};
+        }
+
+        /**
+         * Called by blocking_scope when the current task is about to block.
+         * Ensures that a compensating thread is available to run queued tasks in its place.
+         */
+        void begin_blocking() {
+            const std::lock_guard<std::mutex> tasks_lock(task_mutex);
+            ++num_blocked_workers;
+
+            if (!pool_running) {
+                return;
+            }
+            if (compensating_threads.size() < num_blocked_workers &&
+                compensating_threads.size() < max_compensating_threads) {
+                compensating_threads.emplace_back(&basic_task_thread_pool::compensating_worker_main, this, context_factory,
+                                                  context_type);
+            } else {
+                compensating_cv.notify_one();
+            }
+        }
+
+        /**
+         * Called by blocking_scope when the current task is done blocking.
+         * A compensating thread that is running a task finishes it, then parks.
+         */
+        void end_blocking() {
+            const std::lock_guard<std::mutex> tasks_lock(task_mutex);
+            --num_blocked_workers;
         }
 
         /**
@@ -389,9 +2602,32 @@ namespace task_thread_pool {
         void start_threads(const unsigned int num_threads) {
             const std::lock_guard<std::recursive_mutex> threads_lock(thread_mutex);
 
+            worker_context_factory factory;
+            const void* factory_type = nullptr;
+            {
+                const std::lock_guard<std::mutex> tasks_lock(task_mutex);
+                factory = context_factory;
+                factory_type = context_type;
+            }
+
             for (unsigned int i = 0; i < num_threads; ++i) {
-                threads.emplace_back(&task_thread_pool::worker_main, this);
+                const auto index = static_cast<unsigned int>(threads.size());
+                threads.emplace_back(&basic_task_thread_pool::worker_main, this, index, factory, factory_type);
+            }
+        }
+
+        /**
+         * Start the worker threads that were deferred by the deferred_start constructor.
+         */
+        void start_deferred_threads() {
+            const std::lock_guard<std::recursive_mutex> threads_lock(thread_mutex);
+
+            if (num_deferred_threads > 0) {
+                const unsigned int num_threads = num_deferred_threads;
+                num_deferred_threads = 0;
+                start_threads(num_threads);
             }
+            threads_deferred.store(false, std::memory_order_release);
         }
 
         /**
@@ -400,10 +2636,23 @@ namespace task_thread_pool {
         void stop_all_threads() {
             const std::lock_guard<std::recursive_mutex> threads_lock(thread_mutex);
 
+            std::vector<std::thread> compensating;
+            cpu_arbiter* token_arbiter = nullptr;
             {
                 const std::lock_guard<std::mutex> tasks_lock(task_mutex);
                 pool_running = false;
-                task_cv.notify_all();
+                idle_policy::notify_all(task_cv, task_epoch);
+                compensating_cv.notify_all();
+                if (polling_poller) {
+                    polling_poller->wake();
+                }
+                compensating.swap(compensating_threads);
+                token_arbiter = arbiter;
+            }
+
+            if (token_arbiter) {
+                // wake workers waiting for a CPU token
+                token_arbiter->interrupt();
             }
 
             for (auto& thread : threads) {
@@ -412,6 +2661,12 @@ namespace task_thread_pool {
                 }
             }
             threads.clear();
+
+            for (auto& thread : compensating) {
+                if (thread.joinable()) {
+                    thread.join();
+                }
+            }
         }
 
         /**
@@ -427,11 +2682,51 @@ namespace task_thread_pool {
         mutable std::recursive_mutex thread_mutex;
 
         /**
-         * The task queue.
+         * Number of worker threads that will be started when the first task is submitted.
+         *
+         * Access protected by thread_mutex
+         */
+        unsigned int num_deferred_threads = 0;
+
+        /**
+         * A fast check for whether num_deferred_threads may be non-zero, so that submit does not
+         * need to lock thread_mutex.
+         */
+        std::atomic<bool> threads_deferred{false};
+
+        /**
+         * The task queue. Its blocks are recycled, so a steady flow of tasks does not touch the global heap.
+         *
+         * Access protected by task_mutex.
+         */
+        typename queue_policy::template container<detail::queued_task<task_type>,
+            detail::recycling_allocator<detail::queued_task<task_type>>> tasks = {};
+
+        /**
+         * Tasks submitted with a deadline, as a heap ordered by detail::later_deadline.
+         *
+         * Access protected by task_mutex.
+         */
+        std::vector<detail::deadline_entry<task_type>> deadline_tasks;
+
+        /**
+         * Sequence number of the next task with a deadline.
+         *
+         * Access protected by task_mutex.
+         */
+        uint64_t next_deadline_seq = 0;
+
+        /**
+         * Number of tasks with a deadline popped in a row while tasks without one waited. See max_deadline_burst.
          *
          * Access protected by task_mutex.
          */
-        std::queue<std::packaged_task<void()>> tasks = {};
+        unsigned int deadline_burst = 0;
+
+        /**
+         * Tasks with a deadline that expired before they started.
+         */
+        std::atomic<size_t> num_expired_tasks{0};
 
         /**
          * A mutex for all variables related to tasks.
@@ -443,17 +2738,28 @@ namespace task_thread_pool {
          */
         std::condition_variable task_cv;
 
+        /**
+         * Lets idle workers spin without holding task_mutex. Only touched by idle policies that spin,
+         * see spin_then_block.
+         */
+        std::atomic<unsigned int> task_epoch{0};
+
         /**
          * Used to notify of finished tasks.
          */
         std::condition_variable task_finished_cv;
 
+        /**
+         * Used to wake parked compensating threads.
+         */
+        std::condition_variable compensating_cv;
+
         /**
          * A signal for worker threads that the pool is either running or shutting down.
          *
-         * Access protected by task_mutex.
+         * Written with task_mutex held. Atomic so that workers waiting for a CPU token may read it without the lock.
          */
-        bool pool_running = true;
+        std::atomic<bool> pool_running{true};
 
         /**
          * A signal for worker threads to not pull new tasks from the queue.
@@ -472,14 +2778,210 @@ namespace task_thread_pool {
         /**
          * A counter of the number of tasks in-progress by worker threads.
          * Incremented when a task is popped off the task queue and decremented when that task is complete.
+         * Empty if the counting policy is disabled.
+         *
+         * Access protected by task_mutex.
+         */
+        detail::task_counter<counting_policy::enabled> num_inflight_tasks;
+
+        /**
+         * Threads started to stand in for workers that are inside a blocking_scope.
+         *
+         * Access protected by task_mutex.
+         */
+        std::vector<std::thread> compensating_threads;
+
+        /**
+         * Maximum size of compensating_threads.
+         *
+         * Access protected by task_mutex.
+         */
+        unsigned int max_compensating_threads = 0;
+
+        /**
+         * Number of threads currently inside a blocking_scope.
+         *
+         * Access protected by task_mutex.
+         */
+        unsigned int num_blocked_workers = 0;
+
+        /**
+         * Number of compensating threads currently running a task.
+         *
+         * Access protected by task_mutex.
+         */
+        unsigned int num_running_compensating = 0;
+
+        /**
+         * The event source that idle workers poll, if any.
+         *
+         * Access protected by task_mutex.
+         */
+        idle_poller* poller = nullptr;
+
+        /**
+         * The event source that a worker is currently inside poll() of, if any. Only one worker polls at a time.
+         *
+         * Access protected by task_mutex.
+         */
+        idle_poller* polling_poller = nullptr;
+
+        /**
+         * Creates each worker thread's context. See set_worker_context().
+         *
+         * Access protected by task_mutex.
+         */
+        worker_context_factory context_factory;
+
+        /**
+         * detail::type_tag() of the type of the contexts made by context_factory.
+         *
+         * Access protected by task_mutex.
+         */
+        const void* context_type = nullptr;
+
+        /**
+         * Number of workers waiting on task_cv. If zero then a new task can only be picked up by waking the poller.
+         *
+         * Access protected by task_mutex.
+         */
+        unsigned int num_waiting_workers = 0;
+
+        /**
+         * Callbacks around each task, if any. Replaced as a whole so that workers can use a snapshot without locking.
+         *
+         * Access protected by task_mutex.
+         */
+        std::shared_ptr<const detail::task_hooks> task_hooks;
+
+        /**
+         * Prefix of worker thread names. See set_name().
+         *
+         * Access protected by task_mutex.
+         */
+        std::string name;
+
+        /**
+         * The CPU budget shared with other pools, if any.
+         *
+         * Access protected by task_mutex.
+         */
+        cpu_arbiter* arbiter = nullptr;
+
+        /**
+         * Admission control target sojourn time. Zero if admission control is disabled.
+         *
+         * Access protected by task_mutex.
+         */
+        std::chrono::steady_clock::duration admission_target{0};
+
+        /**
+         * How long sojourn times must stay above admission_target before the pool is overloaded.
+         *
+         * Access protected by task_mutex.
+         */
+        std::chrono::steady_clock::duration admission_interval{0};
+
+        /**
+         * When the pool becomes overloaded if sojourn times stay above admission_target. Zero if they are below.
+         *
+         * Access protected by task_mutex.
+         */
+        std::chrono::steady_clock::time_point first_above_target_time{};
+
+        /**
+         * Set by admission control. Written with task_mutex held, read without it by try_submit().
+         */
+        std::atomic<bool> overloaded{false};
+
+        /**
+         * Tasks rejected by try_submit() and try_submit_detach().
+         */
+        std::atomic<size_t> num_rejected_tasks{0};
+
+        /**
+         * Droppable tasks that were dropped by admission control.
          *
          * Access protected by task_mutex.
          */
-        int num_inflight_tasks = 0;
+        size_t num_shed_tasks = 0;
+    };
+
+    /**
+     * A thread pool with the default policies.
+     */
+    using task_thread_pool = basic_task_thread_pool<>;
+
+    /**
+     * An RAII guard for a task to tell its pool that it is about to block, such as on a disk read or a lock.
+     *
+     * While the guard exists the pool lets a compensating thread run queued tasks in place of the blocked worker,
+     * so the number of threads doing CPU work stays at get_num_threads(). Compensating threads are started on
+     * demand, bounded by set_max_compensating_threads(), and park for reuse once the guard is destroyed.
+     * If the pool uses a cpu_arbiter then the task's CPU token is returned while the guard exists.
+     *
+     * Use only inside a task running on the given pool. The pool must outlive the guard.
+     */
+    class blocking_scope {
+    public:
+        template <typename... Policies>
+        explicit blocking_scope(basic_task_thread_pool<Policies...>& pool)
+            : pool(&pool), end_blocking(&end<basic_task_thread_pool<Policies...>>) {
+            pool.begin_blocking();
+
+            // let another task use this thread's CPU token while it blocks
+            token_arbiter = detail::this_worker().token_arbiter;
+            if (token_arbiter) {
+                token_arbiter->release();
+                detail::this_worker().token_arbiter = nullptr;
+            }
+        }
+
+        ~blocking_scope() {
+            end_blocking(pool);
+
+            if (token_arbiter) {
+                token_arbiter->acquire();
+                detail::this_worker().token_arbiter = token_arbiter;
+            }
+        }
+
+        blocking_scope(const blocking_scope&) = delete;
+        blocking_scope& operator=(const blocking_scope&) = delete;
+
+    protected:
+        template <typename Pool>
+        static void end(void* pool) {
+            static_cast<Pool*>(pool)->end_blocking();
+        }
+
+        void* pool;
+        void (*end_blocking)(void*);
+
+        /**
+         * The arbiter whose token this thread returned, to take one again when unblocked.
+         */
+        cpu_arbiter* token_arbiter = nullptr;
     };
+
+    /**
+     * A process-wide pool that can be shared by all libraries in a process instead of each creating its own.
+     *
+     * The pool is created on first call and its worker threads are started when the first task is submitted,
+     * so a process that never uses it pays nothing. It has one thread per core and is destroyed at exit,
+     * after finishing any queued tasks.
+     *
+     * @return The shared pool.
+     */
+    inline task_thread_pool& global_pool() {
+        static task_thread_pool pool(0, deferred_start);
+        return pool;
+    }
 }
 
 // clean up
+#undef TTP_PROBE
+#undef TTP_PROBE3
 #undef TTP_NODISCARD
 #undef TTP_CXX17
 
@@ -0,0 +1,478 @@
+// SPDX-License-Identifier: BSD-2-Clause OR MIT OR BSL-1.0
+/**
+ * @brief Parallel versions of common standard library algorithms that run on a task_thread_pool.
+ * @see https://github.com/alugowski/task-thread-pool
+ * @author Adam Lugowski
+ * @copyright Copyright (C) 2023 Adam Lugowski.
+ *            Licensed under any of the following open-source licenses:
+ *            BSD-2-Clause license, MIT license, Boost Software License 1.0
+ *            See the LICENSE-*.txt files for full license text.
+ */
+
+#ifndef AL_TASK_THREAD_POOL_ALGORITHM_HPP
+#define AL_TASK_THREAD_POOL_ALGORITHM_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <exception>
+#include <iterator>
+#include <memory>
+#include <vector>
+
+#include "task_thread_pool.hpp"
+
+namespace task_thread_pool {
+
+    namespace detail {
+        /**
+         * Assumed size of a cache line. For contiguous ranges, chunk boundaries are placed on cache line addresses
+         * so that two chunks never write to the same cache line. See chunk_layout.
+         */
+        constexpr size_t cache_line_bytes = 64;
+
+        /**
+         * Smallest chunk worth handing to another thread. Smaller chunks cost more in scheduling than they gain.
+         */
+        constexpr size_t min_chunk_bytes = 4096;
+
+        /**
+         * Number of chunks per participating thread. More than one gives some load balancing
+         * when chunks take uneven time.
+         */
+        constexpr size_t chunks_per_thread = 4;
+
+        /**
+         * Number of elements in the shortest run that spans whole cache lines, such as 16 4-byte elements or
+         * 8 24-byte elements.
+         */
+        inline size_t elements_per_line_run(size_t element_bytes) {
+            size_t a = std::max<size_t>(1, element_bytes);
+            size_t b = cache_line_bytes;
+            while (b != 0) {
+                const size_t r = a % b;
+                a = b;
+                b = r;
+            }
+            return cache_line_bytes / a;
+        }
+
+        /**
+         * Pick how many elements go in each chunk.
+         *
+         * @param num_elements Size of the input range.
+         * @param element_bytes Size of one element.
+         * @param num_threads Number of threads that will process chunks, including the caller.
+         * @return Number of elements per chunk. At least 1, and spans whole cache lines.
+         */
+        inline size_t chunk_size(size_t num_elements, size_t element_bytes, size_t num_threads) {
+            const size_t run = elements_per_line_run(element_bytes);
+            const size_t min_elements = std::max<size_t>(1, min_chunk_bytes / std::max<size_t>(1, element_bytes));
+            const size_t target_chunks = std::max<size_t>(1, num_threads * chunks_per_thread);
+
+            size_t size = std::max((num_elements + target_chunks - 1) / target_chunks, min_elements);
+            // round up to whole cache lines
+            size = (size + run - 1) / run * run;
+            return size;
+        }
+
+        template <typename Iter>
+        using iter_value_t = typename std::iterator_traits<Iter>::value_type;
+
+        template <typename Iter>
+        using iter_difference_t = typename std::iterator_traits<Iter>::difference_type;
+
+        template <typename Iter, typename V = iter_value_t<Iter>,
+                  bool = std::is_object<V>::value && !std::is_same<V, bool>::value>
+        struct is_vector_iterator : std::integral_constant<bool,
+            std::is_same<Iter, typename std::vector<V>::iterator>::value ||
+            std::is_same<Iter, typename std::vector<V>::const_iterator>::value> {};
+
+        template <typename Iter, typename V>
+        struct is_vector_iterator<Iter, V, false> : std::false_type {};
+
+        /**
+         * Whether the elements of a range are known to be adjacent in memory, so that chunk boundaries can be
+         * aligned to their addresses. Pointers and std::vector iterators, plus std::contiguous_iterator in C++20.
+         */
+        template <typename Iter>
+        struct is_contiguous_iterator : std::integral_constant<bool,
+            std::is_pointer<Iter>::value || is_vector_iterator<Iter>::value
+#if defined(__cpp_lib_concepts)
+            || std::contiguous_iterator<Iter>
+#endif
+            > {};
+
+        /**
+         * Number of elements by which a contiguous range starts past a cache-line-aligned run of elements.
+         * Shortening the first chunk by this much puts every later chunk boundary on a cache line.
+         */
+        template <typename Iter>
+        size_t elements_past_line(Iter, std::false_type) {
+            return 0;
+        }
+
+        template <typename Iter>
+        size_t elements_past_line(Iter first, std::true_type) {
+            const size_t element_bytes = sizeof(iter_value_t<Iter>);
+            const auto address = reinterpret_cast<std::uintptr_t>(std::addressof(*first));
+            const size_t run = elements_per_line_run(element_bytes);
+            for (size_t i = 0; i < run; ++i) {
+                if ((address + i * element_bytes) % cache_line_bytes == 0) {
+                    return (run - i) % run;
+                }
+            }
+            // elements are not aligned to a divisor of the cache line size, so no boundary can be
+            return 0;
+        }
+
+        /**
+         * Where each chunk of a range begins and ends.
+         *
+         * All chunks but the first have the same size, a whole number of cache lines. For contiguous ranges the
+         * first chunk is shortened so that every later chunk starts on a cache line.
+         */
+        struct chunk_layout {
+            size_t num_elements;
+            size_t size;
+
+            /**
+             * Length by which the first chunk is shorter than the others. Less than size.
+             */
+            size_t lead;
+            size_t num_chunks;
+
+            /**
+             * @return Index of the first element of a chunk. Chunks past the end begin at num_elements.
+             */
+            size_t begin(size_t chunk) const {
+                return chunk == 0 ? 0 : std::min(chunk * size - lead, num_elements);
+            }
+
+            size_t end(size_t chunk) const {
+                return begin(chunk + 1);
+            }
+        };
+
+        /**
+         * Split a range into chunks.
+         *
+         * @param first Start of the range that is written to. Only its address is used, and only if contiguous.
+         * @param num_elements Size of the range.
+         * @param num_threads Number of threads that will process chunks, including the caller.
+         */
+        template <typename Iter>
+        chunk_layout make_chunk_layout(Iter first, size_t num_elements, size_t num_threads) {
+            chunk_layout layout{num_elements, chunk_size(num_elements, sizeof(iter_value_t<Iter>), num_threads), 0, 0};
+            if (num_elements > 0) {
+                layout.lead = elements_past_line(first, is_contiguous_iterator<Iter>());
+            }
+            layout.num_chunks = (num_elements + layout.lead + layout.size - 1) / layout.size;
+            return layout;
+        }
+
+        /**
+         * Shared state of one parallel loop over chunks.
+         *
+         * Chunks are claimed with an atomic counter by the pool's workers and by the calling thread. The caller only
+         * waits for chunks to finish, never for helper tasks to start, so a parallel algorithm may be called from
+         * within a pool task without deadlocking. Helper tasks that start after all chunks are claimed do nothing.
+         */
+        template <typename Body>
+        class chunk_loop {
+        public:
+            chunk_loop(size_t num_chunks, Body body) : num_chunks(num_chunks), body(std::move(body)) {}
+
+            /**
+             * Claim and process chunks until none are left.
+             */
+            void work() {
+                size_t chunk;
+                while ((chunk = next_chunk.fetch_add(1)) < num_chunks) {
+                    if (!failed.load(std::memory_order_relaxed)) {
+                        try {
+                            body(chunk);
+                        } catch (...) {
+                            const std::lock_guard<std::mutex> lock(mutex);
+                            if (!error) {
+                                error = std::current_exception();
+                            }
+                            failed = true;
+                        }
+                    }
+
+                    const std::lock_guard<std::mutex> lock(mutex);
+                    if (++num_finished_chunks == num_chunks) {
+                        finished_cv.notify_all();
+                    }
+                }
+            }
+
+            /**
+             * Block until all chunks have finished, then rethrow the first exception thrown by the body, if any.
+             */
+            void wait() {
+                std::unique_lock<std::mutex> lock(mutex);
+                finished_cv.wait(lock, [&] { return num_finished_chunks == num_chunks; });
+                if (error) {
+                    std::rethrow_exception(error);
+                }
+            }
+
+        protected:
+            const size_t num_chunks;
+            Body body;
+            std::atomic<size_t> next_chunk{0};
+            std::atomic<bool> failed{false};
+
+            std::mutex mutex;
+            std::condition_variable finished_cv;
+            size_t num_finished_chunks = 0;
+            std::exception_ptr error;
+        };
+
+        /**
+         * Call body(i) for every i in [0, num_chunks) using the pool's workers and the calling thread.
+         * Returns once all calls have finished. Rethrows the first exception thrown by body.
+         */
+        template <typename Body, typename... Policies>
+        void parallel_chunks(basic_task_thread_pool<Policies...>& pool, size_t num_chunks, Body body) {
+            if (num_chunks == 0) {
+                return;
+            }
+            if (num_chunks == 1) {
+                body(0);
+                return;
+            }
+
+            auto loop = std::make_shared<chunk_loop<Body>>(num_chunks, std::move(body));
+
+            const size_t num_helpers = std::min<size_t>(pool.get_num_threads(), num_chunks - 1);
+            for (size_t i = 0; i < num_helpers; ++i) {
+                pool.submit_detach([loop] { loop->work(); });
+            }
+
+            loop->work();
+            loop->wait();
+        }
+
+        /**
+         * Split [0, num_elements) into cache-aware chunks and call body(begin, end) on each in parallel.
+         *
+         * @param first Start of the range that is written to, used to align the chunks.
+         */
+        template <typename Iter, typename Body, typename... Policies>
+        void parallel_ranges(basic_task_thread_pool<Policies...>& pool, Iter first, size_t num_elements, Body body) {
+            const chunk_layout layout = make_chunk_layout(first, num_elements, pool.get_num_threads() + 1);
+
+            parallel_chunks(pool, layout.num_chunks, [&](size_t chunk) {
+                body(layout.begin(chunk), layout.end(chunk));
+            });
+        }
+
+        template <typename Iter>
+        Iter advance_copy(Iter it, size_t n) {
+            std::advance(it, static_cast<iter_difference_t<Iter>>(n));
+            return it;
+        }
+    }
+
+    /**
+     * Apply f to every element of [first, last) in parallel.
+     *
+     * The calling thread also processes elements. Safe to call from within a task running on the same pool.
+     *
+     * @param pool Pool whose workers help process the range.
+     * @param first Start of the range. Must be at least a ForwardIterator.
+     * @param last End of the range.
+     * @param f Function to apply. Called concurrently from multiple threads.
+     */
+    template <typename Iter, typename F, typename... Policies>
+    void parallel_for_each(basic_task_thread_pool<Policies...>& pool, Iter first, Iter last, F f) {
+        const auto n = static_cast<size_t>(std::distance(first, last));
+
+        detail::parallel_ranges(pool, first, n, [&](size_t begin, size_t end) {
+            std::for_each(detail::advance_copy(first, begin), detail::advance_copy(first, end), f);
+        });
+    }
+
+    /**
+     * Write op(x) for every element x of [first, last) to the range starting at d_first, in parallel.
+     *
+     * @param pool Pool whose workers help process the range.
+     * @param first Start of the input range. Must be at least a ForwardIterator.
+     * @param last End of the input range.
+     * @param d_first Start of the output range. Must be at least a ForwardIterator.
+     * @param op Unary operation. Called concurrently from multiple threads.
+     * @return Output iterator to the element past the last element written.
+     */
+    template <typename Iter, typename OutIter, typename UnaryOp, typename... Policies>
+    OutIter parallel_transform(basic_task_thread_pool<Policies...>& pool, Iter first, Iter last, OutIter d_first,
+                               UnaryOp op) {
+        const auto n = static_cast<size_t>(std::distance(first, last));
+
+        detail::parallel_ranges(pool, d_first, n, [&](size_t begin, size_t end) {
+            std::transform(detail::advance_copy(first, begin), detail::advance_copy(first, end),
+                           detail::advance_copy(d_first, begin), op);
+        });
+
+        return detail::advance_copy(d_first, n);
+    }
+
+    /**
+     * Find the first element of [first, last) that satisfies pred, in parallel.
+     *
+     * Chunks stop early once a match is found in an earlier chunk.
+     *
+     * @param pool Pool whose workers help search the range.
+     * @param first Start of the range. Must be at least a ForwardIterator.
+     * @param last End of the range.
+     * @param pred Unary predicate. Called concurrently from multiple threads.
+     * @return Iterator to the first element that satisfies pred, or last if there is none.
+     */
+    template <typename Iter, typename Pred, typename... Policies>
+    Iter parallel_find_if(basic_task_thread_pool<Policies...>& pool, Iter first, Iter last, Pred pred) {
+        const auto n = static_cast<size_t>(std::distance(first, last));
+        std::atomic<size_t> found{n};
+
+        detail::parallel_ranges(pool, first, n, [&](size_t begin, size_t end) {
+            Iter it = detail::advance_copy(first, begin);
+            for (size_t i = begin; i < end; ++i, ++it) {
+                if (found.load(std::memory_order_relaxed) < i) {
+                    // an earlier element already matched
+                    return;
+                }
+                if (pred(*it)) {
+                    size_t prev = found.load();
+                    while (i < prev && !found.compare_exchange_weak(prev, i)) {}
+                    return;
+                }
+            }
+        });
+
+        return detail::advance_copy(first, found.load());
+    }
+
+    /**
+     * Compute the inclusive prefix sum of [first, last) with op and write it to the range starting at d_first,
+     * in parallel.
+     *
+     * Uses two passes: each chunk is scanned independently, then each chunk's output is offset by the total
+     * of all chunks before it.
+     *
+     * @param pool Pool whose workers help process the range.
+     * @param first Start of the input range. Must be at least a ForwardIterator.
+     * @param last End of the input range.
+     * @param d_first Start of the output range. Must be at least a ForwardIterator. May be equal to first.
+     * @param op Associative binary operation. Called concurrently from multiple threads.
+     * @return Output iterator to the element past the last element written.
+     */
+    template <typename Iter, typename OutIter, typename BinaryOp, typename... Policies>
+    OutIter parallel_inclusive_scan(basic_task_thread_pool<Policies...>& pool, Iter first, Iter last, OutIter d_first,
+                                    BinaryOp op) {
+        using T = detail::iter_value_t<OutIter>;
+        const auto n = static_cast<size_t>(std::distance(first, last));
+        if (n == 0) {
+            return d_first;
+        }
+
+        const detail::chunk_layout layout = detail::make_chunk_layout(d_first, n, pool.get_num_threads() + 1);
+        const size_t num_chunks = layout.num_chunks;
+
+        // pass 1: scan each chunk independently
+        detail::parallel_chunks(pool, num_chunks, [&](size_t chunk) {
+            const size_t begin = layout.begin(chunk);
+            const size_t end = layout.end(chunk);
+            Iter in = detail::advance_copy(first, begin);
+            OutIter out = detail::advance_copy(d_first, begin);
+
+            T sum = *in;
+            *out = sum;
+            for (size_t i = begin + 1; i < end; ++i) {
+                sum = op(sum, *++in);
+                *++out = sum;
+            }
+        });
+
+        // running total of all chunks before each chunk
+        std::vector<T> offsets;
+        offsets.reserve(num_chunks);
+        for (size_t chunk = 0; chunk + 1 < num_chunks; ++chunk) {
+            const size_t end = layout.end(chunk);
+            T chunk_total = *detail::advance_copy(d_first, end - 1);
+            offsets.push_back(offsets.empty() ? chunk_total : op(offsets.back(), chunk_total));
+        }
+
+        // pass 2: offset every chunk except the first
+        detail::parallel_chunks(pool, num_chunks - 1, [&](size_t chunk) {
+            const T& offset = offsets[chunk];
+            const size_t begin = layout.begin(chunk + 1);
+            const size_t end = layout.end(chunk + 1);
+            OutIter out = detail::advance_copy(d_first, begin);
+            for (size_t i = begin; i < end; ++i, ++out) {
+                *out = op(offset, *out);
+            }
+        });
+
+        return detail::advance_copy(d_first, n);
+    }
+
+    /**
+     * Compute the inclusive prefix sum of [first, last) and write it to the range starting at d_first, in parallel.
+     * Same as parallel_inclusive_scan with std::plus.
+     */
+    template <typename Iter, typename OutIter, typename... Policies>
+    OutIter parallel_inclusive_scan(basic_task_thread_pool<Policies...>& pool, Iter first, Iter last, OutIter d_first) {
+        return parallel_inclusive_scan(pool, first, last, d_first, std::plus<detail::iter_value_t<OutIter>>());
+    }
+
+    /**
+     * Sort [first, last) in parallel. The sort is not stable.
+     *
+     * Chunks are sorted in parallel with std::sort, then merged pairwise with std::inplace_merge
+     * in rounds of parallel merges.
+     *
+     * @param pool Pool whose workers help sort.
+     * @param first Start of the range. Must be a RandomAccessIterator.
+     * @param last End of the range.
+     * @param comp Comparison function object.
+     */
+    template <typename RandIter, typename Compare, typename... Policies>
+    void parallel_sort(basic_task_thread_pool<Policies...>& pool, RandIter first, RandIter last, Compare comp) {
+        const auto n = static_cast<size_t>(std::distance(first, last));
+        if (n < 2) {
+            return;
+        }
+
+        const detail::chunk_layout layout = detail::make_chunk_layout(first, n, pool.get_num_threads() + 1);
+        const size_t num_chunks = layout.num_chunks;
+
+        detail::parallel_chunks(pool, num_chunks, [&](size_t chunk) {
+            std::sort(detail::advance_copy(first, layout.begin(chunk)), detail::advance_copy(first, layout.end(chunk)),
+                      comp);
+        });
+
+        // each round merges pairs of adjacent sorted runs of `width` chunks each
+        for (size_t width = 1; width < num_chunks; width *= 2) {
+            const size_t num_merges = (num_chunks + 2 * width - 1) / (2 * width);
+            detail::parallel_chunks(pool, num_merges, [&](size_t merge) {
+                const size_t begin = layout.begin(merge * 2 * width);
+                const size_t middle = layout.begin(merge * 2 * width + width);
+                const size_t end = layout.begin(merge * 2 * width + 2 * width);
+                if (middle < end) {
+                    std::inplace_merge(detail::advance_copy(first, begin), detail::advance_copy(first, middle),
+                                       detail::advance_copy(first, end), comp);
+                }
+            });
+        }
+    }
+
+    /**
+     * Sort [first, last) in ascending order in parallel. Same as parallel_sort with std::less.
+     */
+    template <typename RandIter, typename... Policies>
+    void parallel_sort(basic_task_thread_pool<Policies...>& pool, RandIter first, RandIter last) {
+        parallel_sort(pool, first, last, std::less<detail::iter_value_t<RandIter>>());
+    }
+}
+
+#endif
@@ -0,0 +1,272 @@
+// SPDX-License-Identifier: BSD-2-Clause OR MIT OR BSL-1.0
+/**
+ * @brief when_all, when_any, and as_completed for groups of tasks submitted to a task_thread_pool.
+ * @see https://github.com/alugowski/task-thread-pool
+ * @author Adam Lugowski
+ * @copyright Copyright (C) 2023 Adam Lugowski.
+ *            Licensed under any of the following open-source licenses:
+ *            BSD-2-Clause license, MIT license, Boost Software License 1.0
+ *            See the LICENSE-*.txt files for full license text.
+ */
+
+#ifndef AL_TASK_THREAD_POOL_FUTURES_HPP
+#define AL_TASK_THREAD_POOL_FUTURES_HPP
+
+#include <iterator>
+#include <memory>
+#include <vector>
+
+#include "task_thread_pool.hpp"
+
+// MSVC does not correctly set the __cplusplus macro by default, so we must read it from _MSVC_LANG
+// See https://devblogs.microsoft.com/cppblog/msvc-now-correctly-reports-__cplusplus/
+#if __cplusplus >= 201703L || (defined(_MSVC_LANG) && _MSVC_LANG >= 201703L)
+#define TTP_CXX17 1
+#else
+#define TTP_CXX17 0
+#endif
+
+#if TTP_CXX17
+#define TTP_NODISCARD [[nodiscard]]
+#else
+#define TTP_NODISCARD
+#endif
+
+namespace task_thread_pool {
+
+    /**
+     * A group of tasks submitted to a pool whose results can be consumed in completion order.
+     *
+     * Each task records its index in a shared completion list when it finishes, so waiting for "any" or
+     * "the next" result blocks on a single condition variable instead of polling each std::future.
+     *
+     * A group is meant to be used by one thread, typically the one that fans out the tasks. The tasks themselves
+     * run on the pool. The pool must outlive any tasks still running.
+     *
+     * @tparam R Return type of the tasks.
+     * @tparam Pool Type of the pool, such as basic_task_thread_pool<lifo_queue>.
+     */
+    template <typename R, typename Pool = task_thread_pool>
+    class future_group {
+    protected:
+        /**
+         * Shared with the tasks, which may finish after the group is destroyed.
+         */
+        struct completion_state {
+            std::mutex mutex;
+            std::condition_variable completed_cv;
+
+            /**
+             * Indices of finished tasks, in the order they finished.
+             *
+             * Access protected by mutex.
+             */
+            std::vector<size_t> completed;
+
+            void complete(size_t index) {
+                const std::lock_guard<std::mutex> lock(mutex);
+                completed.push_back(index);
+                completed_cv.notify_all();
+            }
+
+            /**
+             * Block until at least count tasks have finished.
+             *
+             * @return Index of the count-th task to finish.
+             */
+            size_t wait_for(size_t count) {
+                std::unique_lock<std::mutex> lock(mutex);
+                completed_cv.wait(lock, [&] { return completed.size() >= count; });
+                return completed[count - 1];
+            }
+        };
+
+        /**
+         * Runs a task then records its completion. The future is ready before the completion is recorded.
+         *
+         * A task that the pool drops without running, such as by clear_task_queue(), also counts as completed,
+         * with a broken promise, so that waiting on the group does not block forever.
+         */
+        template <typename Fn>
+        struct notifying_task {
+            notifying_task(detail::promise_task<R, Fn>&& task, std::shared_ptr<completion_state> state, size_t index)
+                : task(std::move(task)), state(std::move(state)), index(index) {}
+
+            notifying_task(notifying_task&& other) = default;
+
+            ~notifying_task() {
+                if (state && !ran) {
+                    // break the promise before recording completion, so that the future is ready
+                    task.promise = std::promise<R>();
+                    state->complete(index);
+                }
+            }
+
+            void operator()() {
+                ran = true;
+                task();
+                state->complete(index);
+            }
+
+            detail::promise_task<R, Fn> task;
+
+            /**
+             * Null once moved from.
+             */
+            std::shared_ptr<completion_state> state;
+            size_t index;
+            bool ran = false;
+        };
+
+    public:
+        /**
+         * Iterates over a group's futures in the order that their tasks finish.
+         * Dereferencing blocks until the next task finishes.
+         */
+        class completion_iterator {
+        public:
+            using iterator_category = std::input_iterator_tag;
+            using value_type = std::future<R>;
+            using difference_type = std::ptrdiff_t;
+            using pointer = std::future<R>*;
+            using reference = std::future<R>&;
+
+            completion_iterator(future_group* group, size_t position) : group(group), position(position) {}
+
+            /**
+             * @return The future of the next task to finish. It is ready.
+             */
+            reference operator*() const {
+                return group->futures[index()];
+            }
+
+            pointer operator->() const {
+                return &**this;
+            }
+
+            /**
+             * @return The submission index of the next task to finish. Blocks until it finishes.
+             */
+            size_t index() const {
+                return group->state->wait_for(position + 1);
+            }
+
+            completion_iterator& operator++() {
+                ++position;
+                return *this;
+            }
+
+            completion_iterator operator++(int) {
+                completion_iterator ret = *this;
+                ++position;
+                return ret;
+            }
+
+            bool operator==(const completion_iterator& other) const { return position == other.position; }
+            bool operator!=(const completion_iterator& other) const { return position != other.position; }
+
+        protected:
+            future_group* group;
+            size_t position;
+        };
+
+        /**
+         * A range over all of a group's futures in completion order. See as_completed().
+         */
+        class completion_range {
+        public:
+            completion_range(future_group* group, size_t size) : group(group), size(size) {}
+
+            completion_iterator begin() const { return completion_iterator(group, 0); }
+            completion_iterator end() const { return completion_iterator(group, size); }
+
+        protected:
+            future_group* group;
+            size_t size;
+        };
+
+        /**
+         * @param pool The pool that runs the group's tasks.
+         */
+        explicit future_group(Pool& pool) : pool(pool), state(std::make_shared<completion_state>()) {}
+
+        future_group(const future_group&) = delete;
+        future_group& operator=(const future_group&) = delete;
+
+        /**
+         * Submit a Callable to the pool as part of this group.
+         *
+         * @param func The Callable to execute. Can be a function, a lambda, std::packaged_task, std::function, etc.
+         * @param args Arguments for func. Optional.
+         * @return The submission index of the task, starting at 0.
+         */
+        template <typename F, typename... A>
+        size_t submit(F&& func, A&&... args) {
+            const size_t index = futures.size();
+            notifying_task<detail::bound_t<F, A...>> task{
+                detail::make_promise_task<R>(std::forward<F>(func), std::forward<A>(args)...), state, index};
+            futures.push_back(task.task.promise.get_future());
+            pool.submit_detach(std::move(task));
+            return index;
+        }
+
+        /**
+         * @return Number of tasks submitted to this group.
+         */
+        TTP_NODISCARD size_t size() const {
+            return futures.size();
+        }
+
+        /**
+         * Get the future of a task by submission index. Does not wait.
+         */
+        std::future<R>& operator[](size_t index) {
+            return futures[index];
+        }
+
+        /**
+         * Block until every task in the group has finished.
+         *
+         * @return The futures of all tasks, in submission order. All are ready.
+         */
+        std::vector<std::future<R>>& when_all() {
+            if (!futures.empty()) {
+                state->wait_for(futures.size());
+            }
+            return futures;
+        }
+
+        /**
+         * Block until any task in the group has finished. The group must not be empty.
+         *
+         * @return Submission index of the first task to finish. Its future is ready.
+         */
+        size_t when_any() {
+            return state->wait_for(1);
+        }
+
+        /**
+         * Get the futures of all tasks submitted so far, in the order the tasks finish.
+         *
+         * @return A range to use in a range-based for loop. Each step blocks until the next task finishes.
+         */
+        completion_range as_completed() {
+            return completion_range(this, futures.size());
+        }
+
+    protected:
+        Pool& pool;
+        std::shared_ptr<completion_state> state;
+
+        /**
+         * Futures in submission order.
+         */
+        std::vector<std::future<R>> futures;
+    };
+}
+
+// clean up
+#undef TTP_NODISCARD
+#undef TTP_CXX17
+
+#endif
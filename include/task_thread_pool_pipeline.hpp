@@ -0,0 +1,389 @@
+// SPDX-License-Identifier: BSD-2-Clause OR MIT OR BSL-1.0
+/**
+ * @brief Bounded multi-stage streaming pipelines that run on a task_thread_pool.
+ * @see https://github.com/alugowski/task-thread-pool
+ * @author Adam Lugowski
+ * @copyright Copyright (C) 2023 Adam Lugowski.
+ *            Licensed under any of the following open-source licenses:
+ *            BSD-2-Clause license, MIT license, Boost Software License 1.0
+ *            See the LICENSE-*.txt files for full license text.
+ */
+
+#ifndef AL_TASK_THREAD_POOL_PIPELINE_HPP
+#define AL_TASK_THREAD_POOL_PIPELINE_HPP
+
+#include <algorithm>
+#include <deque>
+#include <exception>
+#include <vector>
+
+#include "task_thread_pool.hpp"
+
+namespace task_thread_pool {
+
+    /**
+     * How a pipeline stage may process items.
+     */
+    enum class stage_mode {
+        /**
+         * Any number of items may be in the stage at once.
+         */
+        parallel,
+
+        /**
+         * One item at a time, in the order the items were read from the source.
+         */
+        serial_in_order,
+
+        /**
+         * One item at a time, in any order.
+         */
+        serial_out_of_order
+    };
+
+    /**
+     * A chain of stages that items stream through, such as parse, transform, compress, write.
+     *
+     * Items are read one at a time from a source function and then passed through each stage in turn.
+     * The number of items in flight is bounded by a token limit. Each token owns one item of type T, which is
+     * reused for the next item once the previous one leaves the last stage, so a run uses constant memory.
+     *
+     * An item is carried from stage to stage by the same thread for as long as possible, so it stays in that
+     * thread's cache. It is only handed off through the pool when a serial stage is busy with another item.
+     *
+     * @tparam T Type of an item. Must be default-constructible. The source overwrites a token's item for each input.
+     */
+    template <typename T>
+    class pipeline {
+    public:
+        /**
+         * @param source Called serially to read the next item into its argument. Returns false when there are
+         *               no more items.
+         */
+        explicit pipeline(std::function<bool(T&)> source) : source(std::move(source)) {}
+
+        /**
+         * Append a stage.
+         *
+         * @param mode How the stage may process items.
+         * @param func Called with each item.
+         * @return This pipeline, to chain calls.
+         */
+        pipeline& add_stage(stage_mode mode, std::function<void(T&)> func) {
+            stages.push_back(stage_config{mode, std::move(func)});
+            return *this;
+        }
+
+        /**
+         * Stream all items from the source through all stages. Returns when every item has left the last stage.
+         *
+         * The calling thread also processes items. If a stage or the source throws then no more items are read,
+         * items in flight skip their remaining stages, and the first exception is rethrown here.
+         *
+         * @param pool Pool, with any policies, whose workers process items.
+         * @param max_tokens Maximum number of items in flight at once. If 0 then the pool's number of threads.
+         */
+        template <typename... Policies>
+        void run(basic_task_thread_pool<Policies...>& pool, size_t max_tokens = 0) {
+            if (max_tokens < 1) {
+                max_tokens = pool.get_num_threads();
+            }
+
+            auto state = std::make_shared<run_state>(pool, source, stages, max_tokens);
+
+            const size_t num_helpers = std::min<size_t>(max_tokens, pool.get_num_threads() + 1) - 1;
+            for (size_t i = 0; i < num_helpers; ++i) {
+                pool.submit_detach([state] { state->drain(); });
+            }
+
+            state->drain();
+            state->wait();
+        }
+
+    protected:
+        struct stage_config {
+            stage_mode mode;
+            std::function<void(T&)> func;
+        };
+
+        /**
+         * One item in flight.
+         */
+        struct token {
+            T item;
+
+            /**
+             * Position of the item in the source's output.
+             */
+            size_t seq = 0;
+        };
+
+        /**
+         * A token that was parked at a busy serial stage and may now be resumed there.
+         */
+        struct ready_token {
+            token* tok;
+            size_t stage;
+        };
+
+        /**
+         * The state of a single run. Shared with the helper tasks, some of which may only start after the run is over.
+         */
+        class run_state : public std::enable_shared_from_this<run_state> {
+        public:
+            template <typename... Policies>
+            run_state(basic_task_thread_pool<Policies...>& pool, const std::function<bool(T&)>& source,
+                      const std::vector<stage_config>& stage_configs, size_t max_tokens)
+                : pool(&pool),
+                  submit_drain(&submit_drain_to<basic_task_thread_pool<Policies...>>),
+                  source(source),
+                  tokens(max_tokens) {
+                for (const auto& config : stage_configs) {
+                    stages.push_back(stage{config.mode, config.func});
+                }
+                for (auto& t : tokens) {
+                    free_tokens.push_back(&t);
+                }
+            }
+
+            /**
+             * Resume parked tokens and read new items until there is nothing left for this thread to do.
+             */
+            void drain() {
+                while (true) {
+                    token* tok = nullptr;
+                    size_t stage_index = 0;
+                    bool resumed = false;
+                    {
+                        const std::lock_guard<std::mutex> lock(mutex);
+                        if (!ready.empty()) {
+                            tok = ready.front().tok;
+                            stage_index = ready.front().stage;
+                            resumed = true;
+                            ready.pop_front();
+                        } else if (!input_done && !free_tokens.empty()) {
+                            tok = free_tokens.back();
+                            free_tokens.pop_back();
+                            ++num_active_tokens;
+                        } else {
+                            return;
+                        }
+                    }
+
+                    if (!resumed && !read_input(tok)) {
+                        continue;
+                    }
+                    advance(tok, stage_index);
+                }
+            }
+
+            /**
+             * Block until the run is over, helping with parked tokens and input as they become available.
+             * Rethrows the first exception thrown by the source or a stage.
+             */
+            void wait() {
+                std::unique_lock<std::mutex> lock(mutex);
+                while (!input_done || num_active_tokens > 0) {
+                    if (!ready.empty() || (!input_done && !free_tokens.empty())) {
+                        lock.unlock();
+                        drain();
+                        lock.lock();
+                        continue;
+                    }
+                    state_cv.wait(lock);
+                }
+                if (error) {
+                    std::rethrow_exception(error);
+                }
+            }
+
+        protected:
+            struct stage {
+                stage_mode mode;
+                std::function<void(T&)> func;
+
+                /**
+                 * A serial stage is processing an item.
+                 */
+                bool busy = false;
+
+                /**
+                 * For serial_in_order stages: the seq of the next item allowed in.
+                 */
+                size_t next_seq = 0;
+
+                /**
+                 * Tokens parked because this serial stage was busy or, if in order, it was not their turn yet.
+                 */
+                std::deque<token*> parked = {};
+
+                stage(stage_mode mode, std::function<void(T&)> func) : mode(mode), func(std::move(func)) {}
+            };
+
+            /**
+             * Read the next item from the source into a token.
+             *
+             * @return true if an item was read. If not, the token has been returned.
+             */
+            bool read_input(token* tok) {
+                bool got_item = false;
+                {
+                    const std::lock_guard<std::mutex> lock(source_mutex);
+                    try {
+                        if (!input_done_flag.load(std::memory_order_acquire)) {
+                            got_item = source(tok->item);
+                        }
+                    } catch (...) {
+                        record_error();
+                    }
+
+                    const std::lock_guard<std::mutex> state_lock(mutex);
+                    if (got_item) {
+                        tok->seq = next_seq++;
+                        return true;
+                    }
+                    input_done = true;
+                    input_done_flag = true;
+                }
+                release_token(tok);
+                return false;
+            }
+
+            /**
+             * Carry a token through the stages starting at stage_index, until it either leaves the last stage or
+             * is parked at a busy serial stage.
+             */
+            void advance(token* tok, size_t stage_index) {
+                for (; stage_index < stages.size(); ++stage_index) {
+                    stage& st = stages[stage_index];
+                    const bool serial = st.mode != stage_mode::parallel;
+
+                    if (serial) {
+                        const std::lock_guard<std::mutex> lock(mutex);
+                        if (st.busy || (st.mode == stage_mode::serial_in_order && tok->seq != st.next_seq)) {
+                            st.parked.push_back(tok);
+                            return;
+                        }
+                        st.busy = true;
+                    }
+
+                    // After an error, items still pass through serial stages, without calling them, so that
+                    // in-order stages keep admitting later items.
+                    if (!failed.load(std::memory_order_acquire)) {
+                        try {
+                            st.func(tok->item);
+                        } catch (...) {
+                            record_error();
+                        }
+                    }
+
+                    if (serial) {
+                        leave_serial_stage(st, stage_index);
+                    }
+                }
+
+                release_token(tok);
+            }
+
+            /**
+             * Mark a serial stage as free and hand the next eligible parked token, if any, to the pool.
+             */
+            void leave_serial_stage(stage& st, size_t stage_index) {
+                const std::lock_guard<std::mutex> lock(mutex);
+                st.busy = false;
+
+                auto next = st.parked.end();
+                if (st.mode == stage_mode::serial_in_order) {
+                    ++st.next_seq;
+                    next = std::find_if(st.parked.begin(), st.parked.end(),
+                                        [&](const token* t) { return t->seq == st.next_seq; });
+                } else if (!st.parked.empty()) {
+                    next = st.parked.begin();
+                }
+
+                if (next != st.parked.end()) {
+                    ready.push_back(ready_token{*next, stage_index});
+                    st.parked.erase(next);
+                    state_cv.notify_all();
+
+                    submit_drain(pool, this->shared_from_this());
+                }
+            }
+
+            /**
+             * Return a token whose item has left the pipeline.
+             */
+            void release_token(token* tok) {
+                const std::lock_guard<std::mutex> lock(mutex);
+                free_tokens.push_back(tok);
+                --num_active_tokens;
+                state_cv.notify_all();
+            }
+
+            /**
+             * Remember the current exception, stop reading input, and make items in flight skip their remaining
+             * stages.
+             */
+            void record_error() {
+                const std::lock_guard<std::mutex> lock(mutex);
+                if (!error) {
+                    error = std::current_exception();
+                }
+                failed = true;
+                input_done_flag = true;
+            }
+
+            template <typename Pool>
+            static void submit_drain_to(void* pool, std::shared_ptr<run_state> self) {
+                static_cast<Pool*>(pool)->submit_detach([self] { self->drain(); });
+            }
+
+            /**
+             * The pool that runs helper tasks, and how to hand it one that drains ready tokens.
+             */
+            void* pool;
+            void (*submit_drain)(void*, std::shared_ptr<run_state>);
+            std::function<bool(T&)> source;
+            std::vector<stage> stages;
+            std::vector<token> tokens;
+
+            /**
+             * Serializes calls to source.
+             */
+            std::mutex source_mutex;
+
+            /**
+             * A mutex for all variables below, and for the runtime fields of stages.
+             */
+            std::mutex mutex;
+
+            /**
+             * Used to notify the calling thread of a parked token becoming ready, a token being returned,
+             * or the end of the run.
+             */
+            std::condition_variable state_cv;
+
+            std::deque<ready_token> ready = {};
+            std::vector<token*> free_tokens = {};
+            size_t num_active_tokens = 0;
+            size_t next_seq = 0;
+            bool input_done = false;
+            std::exception_ptr error;
+
+            /**
+             * Set when no more input should be read, either because the source is exhausted or because of an error.
+             */
+            std::atomic<bool> input_done_flag{false};
+
+            /**
+             * Set when the source or a stage has thrown. No more stages are called.
+             */
+            std::atomic<bool> failed{false};
+        };
+
+        std::function<bool(T&)> source;
+        std::vector<stage_config> stages;
+    };
+}
+
+#endif
@@ -0,0 +1,260 @@
+// SPDX-License-Identifier: BSD-2-Clause OR MIT OR BSL-1.0
+/**
+ * @brief An epoll-based idle_poller that dispatches I/O readiness directly on task_thread_pool workers. Linux only.
+ * @see https://github.com/alugowski/task-thread-pool
+ * @author Adam Lugowski
+ * @copyright Copyright (C) 2023 Adam Lugowski.
+ *            Licensed under any of the following open-source licenses:
+ *            BSD-2-Clause license, MIT license, Boost Software License 1.0
+ *            See the LICENSE-*.txt files for full license text.
+ */
+
+#ifndef AL_TASK_THREAD_POOL_REACTOR_HPP
+#define AL_TASK_THREAD_POOL_REACTOR_HPP
+
+#if defined(__linux__)
+
+#include <cerrno>
+#include <cstdint>
+#include <memory>
+#include <system_error>
+#include <vector>
+
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include "task_thread_pool.hpp"
+
+namespace task_thread_pool {
+
+    /**
+     * Dispatches readiness of file descriptors to handlers that run directly on an idle pool worker.
+     *
+     * Replaces a separate event loop thread that forwards each event with submit_detach(). Any pollable file
+     * descriptor may be registered: sockets, pipes, eventfds, timerfds, and also an io_uring ring file descriptor,
+     * which becomes readable when completions are available.
+     *
+     * Only one worker polls at a time, and it runs the handlers of a batch of events one after another.
+     * Handlers should therefore be short, and hand longer work to the pool with submit_detach().
+     * Events are only handled while some worker is idle.
+     *
+     * The pool must outlive the reactor.
+     */
+    class epoll_reactor : public idle_poller {
+    public:
+        /**
+         * Create an epoll set and attach it to a pool's idle workers.
+         *
+         * @param pool The pool, with any policies, whose idle workers poll this reactor.
+         * @throws std::system_error if the epoll set cannot be created.
+         */
+        template <typename... Policies>
+        explicit epoll_reactor(basic_task_thread_pool<Policies...>& pool)
+            : pool(&pool), set_pool_poller(&set_poller<basic_task_thread_pool<Policies...>>) {
+            epoll_fd = ::epoll_create1(EPOLL_CLOEXEC);
+            if (epoll_fd < 0) {
+                throw std::system_error(errno, std::generic_category(), "epoll_create1");
+            }
+
+            wake_fd = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            if (wake_fd < 0) {
+                const int error = errno;
+                ::close(epoll_fd);
+                throw std::system_error(error, std::generic_category(), "eventfd");
+            }
+
+            epoll_event event{};
+            event.events = EPOLLIN;
+            event.data.ptr = nullptr;
+            if (::epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &event) < 0) {
+                const int error = errno;
+                ::close(wake_fd);
+                ::close(epoll_fd);
+                throw std::system_error(error, std::generic_category(), "epoll_ctl");
+            }
+
+            pool.set_idle_poller(this);
+        }
+
+        /**
+         * Detach from the pool, waiting for any in-progress poll to finish, then close the epoll set.
+         * Registered file descriptors are not closed.
+         */
+        ~epoll_reactor() override {
+            set_pool_poller(pool, nullptr);
+            ::close(wake_fd);
+            ::close(epoll_fd);
+        }
+
+        epoll_reactor(const epoll_reactor&) = delete;
+        epoll_reactor& operator=(const epoll_reactor&) = delete;
+
+        /**
+         * Register a file descriptor.
+         *
+         * @param fd The file descriptor. Must not already be registered.
+         * @param events epoll event flags, such as EPOLLIN. EPOLLET and EPOLLONESHOT are allowed.
+         * @param handler Called on a pool worker with the returned events each time fd is ready.
+         * @throws std::system_error if epoll_ctl fails.
+         */
+        void add(int fd, uint32_t events, std::function<void(uint32_t)> handler) {
+            std::unique_ptr<registration> reg(new registration(fd, std::move(handler)));
+
+            epoll_event event{};
+            event.events = events;
+            event.data.ptr = reg.get();
+
+            const std::lock_guard<std::mutex> lock(registrations_mutex);
+            if (::epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0) {
+                throw std::system_error(errno, std::generic_category(), "epoll_ctl");
+            }
+            registrations.push_back(std::move(reg));
+        }
+
+        /**
+         * Change the events that a registered file descriptor is polled for. Also re-arms EPOLLONESHOT registrations.
+         *
+         * @param fd A registered file descriptor.
+         * @param events epoll event flags.
+         * @throws std::system_error if fd is not registered or epoll_ctl fails.
+         */
+        void modify(int fd, uint32_t events) {
+            const std::lock_guard<std::mutex> lock(registrations_mutex);
+            epoll_event event{};
+            event.events = events;
+            event.data.ptr = find(fd);
+            if (::epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &event) < 0) {
+                throw std::system_error(errno, std::generic_category(), "epoll_ctl");
+            }
+        }
+
+        /**
+         * Unregister a file descriptor. Its handler may still run for events already fetched by an in-progress poll,
+         * but not for later ones. The handler is destroyed on a later poll.
+         *
+         * @param fd A registered file descriptor.
+         * @throws std::system_error if fd is not registered.
+         */
+        void remove(int fd) {
+            const std::lock_guard<std::mutex> lock(registrations_mutex);
+            registration* reg = find(fd);
+            ::epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+            reg->removed.store(true, std::memory_order_release);
+
+            for (auto it = registrations.begin(); it != registrations.end(); ++it) {
+                if (it->get() == reg) {
+                    retired.push_back(std::move(*it));
+                    registrations.erase(it);
+                    break;
+                }
+            }
+        }
+
+        /**
+         * Wait for events and run their handlers. Called by the pool.
+         */
+        void poll() override {
+            {
+                // No other thread polls, so no handler of a previous batch can still be in use.
+                const std::lock_guard<std::mutex> lock(registrations_mutex);
+                retired.clear();
+            }
+
+            epoll_event events[max_events_per_poll];
+            const int num_events = ::epoll_wait(epoll_fd, events, max_events_per_poll, -1);
+
+            for (int i = 0; i < num_events; ++i) {
+                auto* reg = static_cast<registration*>(events[i].data.ptr);
+                if (reg == nullptr) {
+                    uint64_t count;
+                    while (::read(wake_fd, &count, sizeof(count)) > 0) {}
+                    continue;
+                }
+                if (reg->removed.load(std::memory_order_acquire)) {
+                    continue;
+                }
+
+                try {
+                    reg->handler(events[i].events);
+                } catch (...) {
+                    // Nothing that the reactor can do anything about.
+                }
+            }
+        }
+
+        /**
+         * Make the polling worker return. Called by the pool.
+         */
+        void wake() override {
+            const uint64_t one = 1;
+            while (::write(wake_fd, &one, sizeof(one)) < 0 && errno == EINTR) {}
+        }
+
+    protected:
+        static constexpr int max_events_per_poll = 64;
+
+        struct registration {
+            registration(int fd, std::function<void(uint32_t)> handler) : fd(fd), handler(std::move(handler)) {}
+
+            const int fd;
+            std::function<void(uint32_t)> handler;
+
+            /**
+             * Set by remove(). The registration may still appear in the current batch of events.
+             */
+            std::atomic<bool> removed{false};
+        };
+
+        /**
+         * Look up a registration.
+         *
+         * Must be called with registrations_mutex held.
+         */
+        registration* find(int fd) {
+            for (auto& reg : registrations) {
+                if (reg->fd == fd) {
+                    return reg.get();
+                }
+            }
+            throw std::system_error(ENOENT, std::generic_category(), "file descriptor not registered");
+        }
+
+        template <typename Pool>
+        static void set_poller(void* pool, idle_poller* poller) {
+            static_cast<Pool*>(pool)->set_idle_poller(poller);
+        }
+
+        void* pool;
+        void (*set_pool_poller)(void*, idle_poller*);
+        int epoll_fd = -1;
+
+        /**
+         * An eventfd registered with a null data.ptr. Written to by wake().
+         */
+        int wake_fd = -1;
+
+        /**
+         * A mutex for registrations and retired. Not taken when dispatching events.
+         */
+        std::mutex registrations_mutex;
+
+        /**
+         * The registered file descriptors. epoll events point directly at these, so dispatch needs no lookup.
+         *
+         * Access protected by registrations_mutex.
+         */
+        std::vector<std::unique_ptr<registration>> registrations;
+
+        /**
+         * Removed registrations that may still be referenced by the current batch of events. Freed by the next poll.
+         *
+         * Access protected by registrations_mutex.
+         */
+        std::vector<std::unique_ptr<registration>> retired;
+    };
+}
+
+#endif
+
+#endif
@@ -0,0 +1,360 @@
+// SPDX-License-Identifier: BSD-2-Clause OR MIT OR BSL-1.0
+/**
+ * @brief Concurrency-limited executor views over a shared task_thread_pool.
+ * @see https://github.com/alugowski/task-thread-pool
+ * @author Adam Lugowski
+ * @copyright Copyright (C) 2023 Adam Lugowski.
+ *            Licensed under any of the following open-source licenses:
+ *            BSD-2-Clause license, MIT license, Boost Software License 1.0
+ *            See the LICENSE-*.txt files for full license text.
+ */
+
+#ifndef AL_TASK_THREAD_POOL_VIEW_HPP
+#define AL_TASK_THREAD_POOL_VIEW_HPP
+
+#include "task_thread_pool.hpp"
+
+// MSVC does not correctly set the __cplusplus macro by default, so we must read it from _MSVC_LANG
+// See https://devblogs.microsoft.com/cppblog/msvc-now-correctly-reports-__cplusplus/
+#if __cplusplus >= 201703L || (defined(_MSVC_LANG) && _MSVC_LANG >= 201703L)
+#define TTP_CXX17 1
+#else
+#define TTP_CXX17 0
+#endif
+
+#if TTP_CXX17
+#define TTP_NODISCARD [[nodiscard]]
+#else
+#define TTP_NODISCARD
+#endif
+
+namespace task_thread_pool {
+
+    /**
+     * A lightweight executor that runs tasks on a shared task_thread_pool, or a basic_task_thread_pool with any
+     * policies, but never occupies more than a fixed number of the pool's workers at a time.
+     *
+     * Tasks that exceed the concurrency limit wait in the view's own queue, not in the pool's queue, so they
+     * do not take workers away from other users of the pool. The view's queue may optionally be bounded.
+     *
+     * The pool must outlive the view. Destroying the view waits for all of its tasks to finish.
+     */
+    class executor_view {
+    public:
+        /**
+         * Create a view over a pool.
+         *
+         * @param pool The pool that runs the tasks.
+         * @param max_concurrency Maximum number of this view's tasks that may run at the same time. If 0 then
+         *                        the limit is the pool's number of threads.
+         * @param max_queued_tasks Maximum number of tasks waiting in this view's queue. If 0 the queue is unbounded.
+         */
+        template <typename... Policies>
+        explicit executor_view(basic_task_thread_pool<Policies...>& pool, unsigned int max_concurrency = 0,
+                               size_t max_queued_tasks = 0)
+            : pool(&pool),
+              pool_num_threads(&num_threads_of<basic_task_thread_pool<Policies...>>),
+              submit_to_pool(&submit_to<basic_task_thread_pool<Policies...>>),
+              max_concurrency(max_concurrency),
+              max_queued_tasks(max_queued_tasks) {
+            if (this->max_concurrency < 1) {
+                this->max_concurrency = pool.get_num_threads();
+            }
+        }
+
+        /**
+         * Wait for all of this view's tasks to finish.
+         */
+        ~executor_view() {
+            wait_for_tasks();
+        }
+
+        executor_view(const executor_view&) = delete;
+        executor_view& operator=(const executor_view&) = delete;
+
+        /**
+         * Get the concurrency limit.
+         *
+         * @return Maximum number of this view's tasks that may run at the same time.
+         */
+        TTP_NODISCARD unsigned int get_max_concurrency() const {
+            const std::lock_guard<std::mutex> view_lock(view_mutex);
+            return max_concurrency;
+        }
+
+        /**
+         * Set the concurrency limit. Lowering the limit does not interrupt running tasks.
+         *
+         * @param new_max_concurrency Maximum number of this view's tasks that may run at the same time.
+         *                            If 0 then the limit is the pool's number of threads.
+         */
+        void set_max_concurrency(unsigned int new_max_concurrency) {
+            if (new_max_concurrency < 1) {
+                new_max_concurrency = pool_num_threads(pool);
+            }
+            const std::lock_guard<std::mutex> view_lock(view_mutex);
+            max_concurrency = new_max_concurrency;
+            schedule_queued_tasks();
+        }
+
+        /**
+         * Get number of tasks waiting in this view's queue.
+         *
+         * @return Number of tasks that have been submitted to this view but not yet handed to the pool.
+         */
+        TTP_NODISCARD size_t get_num_queued_tasks() const {
+            const std::lock_guard<std::mutex> view_lock(view_mutex);
+            return tasks.size();
+        }
+
+        /**
+         * Get number of this view's tasks that occupy a pool worker.
+         *
+         * @return Number of tasks handed to the pool that have not yet finished. Never exceeds the concurrency limit.
+         */
+        TTP_NODISCARD size_t get_num_running_tasks() const {
+            const std::lock_guard<std::mutex> view_lock(view_mutex);
+            return num_inflight_tasks;
+        }
+
+        /**
+         * Submit a Callable for the view to execute and return a std::future.
+         * If the view's queue is bounded and full then block until there is room.
+         *
+         * @param func The Callable to execute. Can be a function, a lambda, std::packaged_task, std::function, etc.
+         * @param args Arguments for func. Optional.
+         * @return std::future that can be used to get func's return value or thrown exception.
+         */
+        template <typename F, typename... A,
+            typename R = detail::invoke_result_t<decay_t<F>, decay_t<A>...>>
+        TTP_NODISCARD std::future<R> submit(F&& func, A&&... args) {
+#if defined(_MSC_VER)
+            // MSVC's packaged_task is not movable even though it should be. See task_thread_pool::submit().
+            std::shared_ptr<std::packaged_task<R()>> ptask =
+                std::make_shared<std::packaged_task<R()>>(std::bind(std::forward<F>(func), std::forward<A>(args)...));
+            submit_detach([ptask] { (*ptask)(); });
+            return ptask->get_future();
+#else
+            std::packaged_task<R()> task(std::bind(std::forward<F>(func), std::forward<A>(args)...));
+            auto ret = task.get_future();
+            submit_detach(std::move(task));
+            return ret;
+#endif
+        }
+
+        /**
+         * Submit a Callable with optional arguments for the view to execute.
+         * If the view's queue is bounded and full then block until there is room.
+         *
+         * @param func The Callable to execute. Can be a function, a lambda, std::packaged_task, std::function, etc.
+         * @param args Arguments for func. Optional.
+         */
+        template <typename F, typename... A>
+        void submit_detach(F&& func, A&&... args) {
+            std::unique_lock<std::mutex> view_lock(view_mutex);
+            room_cv.wait(view_lock, [&] { return has_room(); });
+            enqueue(std::forward<F>(func), std::forward<A>(args)...);
+        }
+
+        /**
+         * Submit a Callable with optional arguments for the view to execute, unless the view's queue is full.
+         *
+         * @param func The Callable to execute. Can be a function, a lambda, std::packaged_task, std::function, etc.
+         * @param args Arguments for func. Optional.
+         * @return true if the task was accepted, false if the view's queue is full.
+         */
+        template <typename F, typename... A>
+        bool try_submit_detach(F&& func, A&&... args) {
+            const std::lock_guard<std::mutex> view_lock(view_mutex);
+            if (!has_room()) {
+                return false;
+            }
+            enqueue(std::forward<F>(func), std::forward<A>(args)...);
+            return true;
+        }
+
+        /**
+         * Block until all of this view's tasks have finished. Tasks submitted to the pool by other means
+         * are not waited for.
+         */
+        void wait_for_tasks() {
+            std::unique_lock<std::mutex> view_lock(view_mutex);
+            task_finished_cv.wait(view_lock, [&] { return tasks.empty() && num_inflight_tasks == 0; });
+        }
+
+    protected:
+        /**
+         * Check whether a new task may be accepted.
+         *
+         * Must be called with view_mutex held.
+         */
+        bool has_room() const {
+            return max_queued_tasks == 0 || num_inflight_tasks < max_concurrency || tasks.size() < max_queued_tasks;
+        }
+
+        /**
+         * Add a task to the view's queue and hand it to the pool if under the concurrency limit.
+         *
+         * Must be called with view_mutex held.
+         */
+        template <typename F>
+        void enqueue(F&& func) {
+            tasks.emplace(std::forward<F>(func));
+            schedule_queued_tasks();
+        }
+
+        template <typename F, typename... A>
+        void enqueue(F&& func, A&&... args) {
+            tasks.emplace(std::bind(std::forward<F>(func), std::forward<A>(args)...));
+            schedule_queued_tasks();
+        }
+
+        /**
+         * Hand queued tasks to the pool until the concurrency limit is reached.
+         *
+         * Must be called with view_mutex held.
+         */
+        void schedule_queued_tasks() {
+            while (!tasks.empty() && num_inflight_tasks < max_concurrency) {
+                std::packaged_task<void()> task{std::move(tasks.front())};
+                tasks.pop();
+                ++num_inflight_tasks;
+                room_cv.notify_one();
+                submit_to_pool(pool, pool_task(this, std::move(task)));
+            }
+        }
+
+        /**
+         * The callable that the view hands to the pool.
+         *
+         * If the pool drops it without running it, such as by clear_task_queue(), the destructor frees the
+         * concurrency slot so that the view's remaining tasks still get scheduled.
+         */
+        struct pool_task {
+            pool_task(executor_view* view, std::packaged_task<void()>&& task) : view(view), task(std::move(task)) {}
+
+            pool_task(pool_task&& other) noexcept : view(other.view), task(std::move(other.task)), ran(other.ran) {
+                other.view = nullptr;
+            }
+
+            ~pool_task() {
+                if (view && !ran) {
+                    // break the promise before freeing the slot, so that the view's waiters see a ready future
+                    task = std::packaged_task<void()>();
+                    view->finish_task();
+                }
+            }
+
+            void operator()() {
+                ran = true;
+                view->run_task(task);
+            }
+
+            /**
+             * Null once moved from.
+             */
+            executor_view* view;
+            std::packaged_task<void()> task;
+            bool ran = false;
+        };
+
+        template <typename Pool>
+        static unsigned int num_threads_of(void* pool) {
+            return static_cast<Pool*>(pool)->get_num_threads();
+        }
+
+        template <typename Pool>
+        static void submit_to(void* pool, pool_task&& task) {
+#if defined(_MSC_VER)
+            // MSVC's packaged_task is not movable even though it should be. See task_thread_pool::submit().
+            std::shared_ptr<pool_task> ptask = std::make_shared<pool_task>(std::move(task));
+            static_cast<Pool*>(pool)->submit_detach([ptask] { (*ptask)(); });
+#else
+            static_cast<Pool*>(pool)->submit_detach(std::move(task));
+#endif
+        }
+
+        /**
+         * Run a task on a pool worker, then let the next queued task take its place.
+         *
+         * The next task is resubmitted to the pool instead of run in a loop so that other users of the pool
+         * get a fair share of the workers.
+         */
+        void run_task(std::packaged_task<void()>& task) {
+            try {
+                task();
+            } catch (...) {
+                // std::packaged_task::operator() may throw in some error conditions, such as if the task
+                // had already been run. Nothing that the view can do anything about.
+            }
+
+            finish_task();
+        }
+
+        /**
+         * Free a task's concurrency slot and let the next queued task take its place.
+         */
+        void finish_task() {
+            const std::lock_guard<std::mutex> view_lock(view_mutex);
+            --num_inflight_tasks;
+            schedule_queued_tasks();
+            if (tasks.empty() && num_inflight_tasks == 0) {
+                task_finished_cv.notify_all();
+            }
+        }
+
+        /**
+         * The pool that runs this view's tasks, and its methods that the view uses.
+         */
+        void* pool;
+        unsigned int (*pool_num_threads)(void*);
+        void (*submit_to_pool)(void*, pool_task&&);
+
+        /**
+         * Tasks that are waiting for a free concurrency slot.
+         *
+         * Access protected by view_mutex.
+         */
+        std::queue<std::packaged_task<void()>> tasks = {};
+
+        /**
+         * A mutex for all variables of this view.
+         */
+        mutable std::mutex view_mutex;
+
+        /**
+         * Used to notify that there is room in the view's queue.
+         */
+        std::condition_variable room_cv;
+
+        /**
+         * Used to notify that all of this view's tasks have finished.
+         */
+        std::condition_variable task_finished_cv;
+
+        /**
+         * Maximum number of this view's tasks that occupy a pool worker at the same time.
+         *
+         * Access protected by view_mutex.
+         */
+        unsigned int max_concurrency;
+
+        /**
+         * Maximum length of the view's queue, or 0 for unbounded.
+         */
+        const size_t max_queued_tasks;
+
+        /**
+         * A counter of this view's tasks that have been handed to the pool but have not finished.
+         *
+         * Access protected by view_mutex.
+         */
+        unsigned int num_inflight_tasks = 0;
+    };
+}
+
+// clean up
+#undef TTP_NODISCARD
+#undef TTP_CXX17
+
+#endif
@@ -0,0 +1,171 @@
+// Copyright (C) 2023 Adam Lugowski. All rights reserved.
+// Use of this source code is governed by the BSD 2-clause license, the MIT license, or at your choosing the BSL-1.0 license found in the LICENSE.*.txt files.
+// SPDX-License-Identifier: BSD-2-Clause OR MIT OR BSL-1.0
+
+#include <list>
+#include <numeric>
+#include <random>
+
+#include <catch2/catch_test_macros.hpp>
+#include <task_thread_pool_algorithm.hpp>
+
+static std::vector<int> random_vector(size_t size) {
+    std::mt19937 rng(size);
+    std::uniform_int_distribution<int> dist(-1000, 1000);
+    std::vector<int> v(size);
+    for (auto& x : v) {
+        x = dist(rng);
+    }
+    return v;
+}
+
+static const size_t test_sizes[] = {0, 1, 2, 1000, 100003};
+
+TEST_CASE("parallel_for_each", "[algorithm]") {
+    task_thread_pool::task_thread_pool pool(4);
+    for (size_t size : test_sizes) {
+        std::vector<int> v(size, 1);
+        task_thread_pool::parallel_for_each(pool, v.begin(), v.end(), [](int& x) { x *= 2; });
+        REQUIRE(std::count(v.begin(), v.end(), 2) == static_cast<long>(size));
+    }
+
+    // forward iterators
+    std::list<int> l(5000, 1);
+    std::atomic<int> sum{0};
+    task_thread_pool::parallel_for_each(pool, l.begin(), l.end(), [&](int x) { sum += x; });
+    REQUIRE(sum == 5000);
+}
+
+TEST_CASE("parallel_transform", "[algorithm]") {
+    task_thread_pool::task_thread_pool pool(4);
+    for (size_t size : test_sizes) {
+        std::vector<int> in = random_vector(size);
+        std::vector<long> out(size);
+        auto end = task_thread_pool::parallel_transform(pool, in.begin(), in.end(), out.begin(),
+                                                        [](int x) { return 3L * x; });
+        REQUIRE(end == out.end());
+
+        std::vector<long> expected(size);
+        std::transform(in.begin(), in.end(), expected.begin(), [](int x) { return 3L * x; });
+        REQUIRE(out == expected);
+    }
+}
+
+TEST_CASE("parallel_find_if", "[algorithm]") {
+    task_thread_pool::task_thread_pool pool(4);
+    for (size_t size : test_sizes) {
+        std::vector<int> v(size);
+        std::iota(v.begin(), v.end(), 0);
+
+        REQUIRE(task_thread_pool::parallel_find_if(pool, v.begin(), v.end(), [](int) { return false; }) == v.end());
+        for (int target : {0, 1, 999, 50000, 100002}) {
+            auto expected = std::find_if(v.begin(), v.end(), [&](int x) { return x >= target; });
+            auto found = task_thread_pool::parallel_find_if(pool, v.begin(), v.end(), [&](int x) { return x >= target; });
+            REQUIRE(found == expected);
+        }
+    }
+}
+
+TEST_CASE("parallel_inclusive_scan", "[algorithm]") {
+    task_thread_pool::task_thread_pool pool(4);
+    for (size_t size : test_sizes) {
+        std::vector<int> in = random_vector(size);
+        std::vector<int> expected(size);
+        std::partial_sum(in.begin(), in.end(), expected.begin());
+
+        std::vector<int> out(size);
+        auto end = task_thread_pool::parallel_inclusive_scan(pool, in.begin(), in.end(), out.begin());
+        REQUIRE(end == out.end());
+        REQUIRE(out == expected);
+
+        // in-place
+        task_thread_pool::parallel_inclusive_scan(pool, in.begin(), in.end(), in.begin());
+        REQUIRE(in == expected);
+    }
+}
+
+TEST_CASE("parallel_sort", "[algorithm]") {
+    task_thread_pool::task_thread_pool pool(4);
+    for (size_t size : test_sizes) {
+        std::vector<int> v = random_vector(size);
+        std::vector<int> expected = v;
+        std::sort(expected.begin(), expected.end());
+
+        task_thread_pool::parallel_sort(pool, v.begin(), v.end());
+        REQUIRE(v == expected);
+
+        task_thread_pool::parallel_sort(pool, v.begin(), v.end(), std::greater<int>());
+        REQUIRE(std::is_sorted(v.begin(), v.end(), std::greater<int>()));
+    }
+}
+
+TEST_CASE("parallel-algorithm-exceptions-and-nesting", "[algorithm]") {
+    task_thread_pool::task_thread_pool pool(2);
+    std::vector<int> v(100000, 1);
+
+    REQUIRE_THROWS_AS(task_thread_pool::parallel_for_each(pool, v.begin(), v.end(), [](int x) {
+        if (x == 1) throw std::invalid_argument("test");
+    }), std::invalid_argument);
+
+    // calling from within tasks of the same pool must not deadlock, even with every worker busy
+    std::vector<std::future<long>> futures;
+    for (int i = 0; i < 4; ++i) {
+        futures.push_back(pool.submit([&] {
+            std::atomic<long> sum{0};
+            task_thread_pool::parallel_for_each(pool, v.begin(), v.end(), [&](int x) { sum += x; });
+            return sum.load();
+        }));
+    }
+    for (auto& f : futures) {
+        REQUIRE(f.get() == 100000);
+    }
+}
+
+TEST_CASE("parallel-algorithm-chunk-alignment", "[algorithm]") {
+    std::vector<int> v = random_vector(100003);
+
+    // start one element past the vector's start so that the range does not begin on a cache line
+    int* first = v.data() + 1;
+    const size_t n = v.size() - 1;
+    const auto layout = task_thread_pool::detail::make_chunk_layout(first, n, 8);
+    REQUIRE(layout.num_chunks > 1);
+    REQUIRE(layout.lead < layout.size);
+    REQUIRE(layout.begin(0) == 0);
+    REQUIRE(layout.end(layout.num_chunks - 1) == n);
+    for (size_t chunk = 1; chunk < layout.num_chunks; ++chunk) {
+        REQUIRE(layout.begin(chunk) > layout.begin(chunk - 1));
+        REQUIRE(reinterpret_cast<std::uintptr_t>(first + layout.begin(chunk)) % 64 == 0);
+    }
+
+    // non-contiguous ranges are not aligned
+    std::list<int> l(1000);
+    REQUIRE(task_thread_pool::detail::make_chunk_layout(l.begin(), l.size(), 8).lead == 0);
+
+    task_thread_pool::task_thread_pool pool;
+    std::vector<int> expected(first, first + n);
+    std::sort(expected.begin(), expected.end());
+    task_thread_pool::parallel_sort(pool, first, first + n);
+    REQUIRE(std::equal(expected.begin(), expected.end(), first));
+}
+
+TEST_CASE("parallel-policy-pool", "[algorithm]") {
+    task_thread_pool::basic_task_thread_pool<task_thread_pool::lifo_queue, task_thread_pool::spin_then_block<>> pool(4);
+
+    std::vector<int> v = random_vector(100003);
+    std::vector<int> expected = v;
+    std::sort(expected.begin(), expected.end());
+    task_thread_pool::parallel_sort(pool, v.begin(), v.end());
+    REQUIRE(v == expected);
+
+    std::vector<int> out(v.size());
+    task_thread_pool::parallel_transform(pool, v.begin(), v.end(), out.begin(), [](int x) { return 2 * x; });
+    task_thread_pool::parallel_for_each(pool, out.begin(), out.end(), [](int& x) { x /= 2; });
+    REQUIRE(out == v);
+
+    std::vector<int> scanned(v.size());
+    std::partial_sum(v.begin(), v.end(), expected.begin());
+    task_thread_pool::parallel_inclusive_scan(pool, v.begin(), v.end(), scanned.begin());
+    REQUIRE(scanned == expected);
+
+    REQUIRE(task_thread_pool::parallel_find_if(pool, v.begin(), v.end(), [](int x) { return x > 2000; }) == v.end());
+}
@@ -2,6 +2,9 @@
 // Use of this source code is governed by the BSD 2-clause license, the MIT license, or at your choosing the BSL-1.0 license found in the LICENSE.*.txt files.
 // SPDX-License-Identifier: BSD-2-Clause OR MIT OR BSL-1.0
 
+#include <array>
+#include <string>
+
 #include <catch2/catch_test_macros.hpp>
 #include <task_thread_pool.hpp>
 
@@ -20,6 +23,34 @@ TEST_CASE("constructor", "") {
     }
 }
 
+TEST_CASE("deferred_start", "") {
+    {
+        // never started
+        task_thread_pool::task_thread_pool pool(4, task_thread_pool::deferred_start);
+        REQUIRE(pool.get_num_threads() == 4);
+        pool.wait_for_tasks();
+    }
+    {
+        task_thread_pool::task_thread_pool pool(4, task_thread_pool::deferred_start);
+        pool.set_num_threads(2);
+        REQUIRE(pool.get_num_threads() == 2);
+        REQUIRE(pool.submit([] { return 1; }).get() == 1);
+        REQUIRE(pool.get_num_threads() == 2);
+        REQUIRE(measure_number_of_threads(pool) == 2);
+    }
+    {
+        task_thread_pool::task_thread_pool pool(0, task_thread_pool::deferred_start);
+        REQUIRE(pool.get_num_threads() == std::thread::hardware_concurrency());
+    }
+}
+
+TEST_CASE("global_pool", "") {
+    task_thread_pool::task_thread_pool& pool = task_thread_pool::global_pool();
+    REQUIRE(&pool == &task_thread_pool::global_pool());
+    REQUIRE(pool.get_num_threads() == std::thread::hardware_concurrency());
+    REQUIRE(pool.submit([] { return 1; }).get() == 1);
+}
+
 TEST_CASE("get_thread_count", "") {
     for (unsigned int num_threads : {1, 4, 100}) {
         task_thread_pool::task_thread_pool pool(num_threads);
@@ -99,6 +130,118 @@ TEST_CASE("clear_task_queue", "") {
 }
 
 
+TEST_CASE("blocking_scope", "") {
+    task_thread_pool::task_thread_pool pool(1);
+    REQUIRE(pool.get_max_compensating_threads() == 1);
+
+    // The only worker blocks waiting on a task queued behind it. A compensating thread must run that task.
+    auto outer = pool.submit([&] {
+        auto inner = pool.submit([] { return 2; });
+        task_thread_pool::blocking_scope blocking(pool);
+        return inner.get();
+    });
+    REQUIRE(outer.get() == 2);
+
+    // after the scope ends the compensating thread no longer runs tasks
+    REQUIRE(measure_number_of_threads(pool) == 1);
+
+    // with compensation disabled the queued task waits for the blocked worker
+    pool.set_max_compensating_threads(0);
+    std::atomic<bool> second_ran{false};
+    std::atomic<bool> second_ran_early{false};
+    pool.submit_detach([&] {
+        pool.submit_detach([&] { second_ran = true; });
+        task_thread_pool::blocking_scope blocking(pool);
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        second_ran_early = second_ran.load();
+    });
+    pool.wait_for_tasks();
+    REQUIRE_FALSE(second_ran_early);
+    REQUIRE(second_ran);
+}
+
+TEST_CASE("worker_index_and_context", "") {
+    REQUIRE(task_thread_pool::current_worker_index() == task_thread_pool::no_worker_index);
+    REQUIRE(task_thread_pool::current_worker_context<int>() == nullptr);
+
+    struct scratch {
+        unsigned int worker;
+        std::thread::id thread;
+    };
+
+    task_thread_pool::task_thread_pool pool(4);
+    pool.set_worker_context<scratch>([](unsigned int index) {
+        return std::make_shared<scratch>(scratch{index, std::this_thread::get_id()});
+    });
+
+    std::mutex seen_mutex;
+    std::set<unsigned int> seen;
+    std::atomic<int> num_mismatched{0};
+    for (int i = 0; i < 200; ++i) {
+        pool.submit_detach([&] {
+            unsigned int index = task_thread_pool::current_worker_index();
+            scratch* context = task_thread_pool::current_worker_context<scratch>();
+            if (context == nullptr || context->worker != index || context->thread != std::this_thread::get_id()) {
+                ++num_mismatched;
+            }
+
+            const std::lock_guard<std::mutex> lock(seen_mutex);
+            seen.insert(index);
+        });
+    }
+    pool.wait_for_tasks();
+    REQUIRE(num_mismatched == 0);
+    REQUIRE(!seen.empty());
+    REQUIRE(*seen.rbegin() < 4);
+
+    // the calling thread is unaffected
+    REQUIRE(task_thread_pool::current_worker_index() == task_thread_pool::no_worker_index);
+
+    // indices stay within range after resizing
+    pool.set_num_threads(2);
+    REQUIRE(pool.submit([] { return task_thread_pool::current_worker_index(); }).get() < 2);
+    REQUIRE(pool.submit([] { return task_thread_pool::current_worker_context<scratch>() != nullptr; }).get());
+
+    // a context of another type is not handed out
+    REQUIRE(pool.submit([] { return task_thread_pool::current_worker_context<int>() == nullptr; }).get());
+
+    pool.set_worker_context<scratch>(nullptr);
+    REQUIRE(pool.submit([] { return task_thread_pool::current_worker_context<scratch>() == nullptr; }).get());
+}
+
+TEST_CASE("submit_with_context", "") {
+    struct scratch {
+        unsigned int worker;
+        int uses;
+    };
+
+    task_thread_pool::task_thread_pool pool(4);
+    pool.set_worker_context<scratch>([](unsigned int index) { return std::make_shared<scratch>(scratch{index, 0}); });
+
+    std::atomic<int> num_mismatched{0};
+    for (int i = 0; i < 200; ++i) {
+        pool.submit_detach_with_context<scratch>([&](scratch& ctx) {
+            ++ctx.uses;
+            if (ctx.worker != task_thread_pool::current_worker_index()) {
+                ++num_mismatched;
+            }
+        });
+    }
+    pool.wait_for_tasks();
+    REQUIRE(num_mismatched == 0);
+
+    auto worker = pool.submit_with_context<scratch>([](scratch& ctx, int add) { return ctx.worker + add; }, 10);
+    REQUIRE(worker.get() >= 10);
+
+    // the wrong context type fails the future
+    auto wrong = pool.submit_with_context<int>([](int& ctx) { return ctx; });
+    REQUIRE_THROWS_AS(wrong.get(), std::logic_error);
+
+    pool.set_worker_context<scratch>(nullptr);
+    auto none = pool.submit_with_context<scratch>([](scratch&) {});
+    REQUIRE_THROWS_AS(none.get(), std::logic_error);
+}
+
 TEST_CASE("sum", "") {
     std::atomic<int> count{0};
     {
@@ -244,3 +387,418 @@ TEST_CASE("rerun-packaged-task", "") {
     REQUIRE_NOTHROW(f3.get());
     REQUIRE(task_run_count == 2);
 }
+
+TEST_CASE("task-storage", "") {
+    task_thread_pool::task_thread_pool pool{4};
+
+    // move-only callable
+    std::unique_ptr<int> ptr(new int(5));
+    auto f1 = pool.submit([p = std::move(ptr)] { return *p; });
+    REQUIRE(f1.get() == 5);
+
+    // callables too large to be stored inline, and results of many sizes
+    std::array<char, 4096> big{};
+    big[100] = 7;
+    auto f2 = pool.submit([big] { return big; });
+    REQUIRE(f2.get()[100] == 7);
+
+    // blocks freed on the workers are recycled across threads
+    for (int round = 0; round < 10; ++round) {
+        std::vector<std::future<std::string>> futures;
+        for (int i = 0; i < 1000; ++i) {
+            futures.push_back(pool.submit([i] { return std::string(static_cast<size_t>(i % 100), 'x'); }));
+        }
+        for (int i = 0; i < 1000; ++i) {
+            REQUIRE(futures[i].get().size() == static_cast<size_t>(i % 100));
+        }
+    }
+
+    // over-aligned callables and results
+    struct alignas(64) over_aligned {
+        char c[64];
+    };
+    over_aligned x{};
+    x.c[10] = 4;
+    auto f4 = pool.submit([] {
+        over_aligned ret{};
+        ret.c[20] = 6;
+        return ret;
+    });
+    REQUIRE(f4.get().c[20] == 6);
+    std::atomic<int> captured{0};
+    pool.submit_detach([x, &captured] { captured = x.c[10]; });
+    pool.wait_for_tasks();
+    REQUIRE(captured == 4);
+
+    // queued tasks that never run break their promise
+    std::future<int> f3;
+    {
+        task_thread_pool::task_thread_pool paused_pool{1};
+        paused_pool.pause();
+        f3 = paused_pool.submit([] { return 1; });
+        paused_pool.clear_task_queue();
+    }
+    REQUIRE_THROWS_AS(f3.get(), std::future_error);
+}
+
+TEST_CASE("policies", "") {
+    SECTION("lifo_queue") {
+        task_thread_pool::basic_task_thread_pool<task_thread_pool::lifo_queue> pool{1};
+        std::vector<int> order;
+        pool.pause();
+        for (int i = 0; i < 5; ++i) {
+            pool.submit_detach([&order, i] { order.push_back(i); });
+        }
+        pool.unpause();
+        pool.wait_for_tasks();
+        REQUIRE(order == std::vector<int>{4, 3, 2, 1, 0});
+    }
+
+    SECTION("spin_then_block") {
+        task_thread_pool::basic_task_thread_pool<task_thread_pool::spin_then_block<>> pool{2};
+        for (int i = 0; i < 100; ++i) {
+            REQUIRE(pool.submit([i] { return i; }).get() == i);
+        }
+
+        // workers that spin for a long time still see unpause and shutdown
+        task_thread_pool::basic_task_thread_pool<task_thread_pool::spin_then_block<100000000>> spinning_pool{2};
+        spinning_pool.pause();
+        auto f = spinning_pool.submit([] { return 1; });
+        spinning_pool.unpause();
+        REQUIRE(f.get() == 1);
+    }
+
+    SECTION("task_storage") {
+        task_thread_pool::basic_task_thread_pool<task_thread_pool::task_storage<256>> pool{2};
+        std::array<char, 200> inline_capture{};
+        inline_capture[199] = 3;
+        REQUIRE(pool.submit([inline_capture] { return inline_capture[199]; }).get() == 3);
+    }
+
+    SECTION("no task counting") {
+        std::atomic<int> sum{0};
+        {
+            task_thread_pool::basic_task_thread_pool<task_thread_pool::task_storage<sizeof(void*)>,
+                                                     task_thread_pool::task_counting<false>> pool{2};
+            for (int i = 0; i < 5; ++i) {
+                pool.submit_detach([&sum, i] { sum += i; });
+            }
+            REQUIRE(pool.submit([] { return 1; }).get() == 1);
+            pool.wait_for_queued_tasks();
+        }
+        REQUIRE(sum == 10);
+    }
+
+    SECTION("blocking_scope") {
+        task_thread_pool::basic_task_thread_pool<task_thread_pool::lifo_queue> pool{1};
+        auto f = pool.submit([&] {
+            task_thread_pool::blocking_scope blocking(pool);
+            return pool.submit([] { return 2; }).get();
+        });
+        REQUIRE(f.get() == 2);
+    }
+}
+
+TEST_CASE("admission_control", "") {
+    task_thread_pool::task_thread_pool pool{1};
+
+    // disabled by default
+    REQUIRE_FALSE(pool.is_overloaded());
+    REQUIRE(pool.try_submit([] { return 1; }).get() == 1);
+    REQUIRE(pool.try_submit_detach([] {}));
+
+    pool.set_admission_control(std::chrono::milliseconds(1), std::chrono::milliseconds(5));
+
+    // queue more slow tasks than the single worker can keep up with
+    pool.pause();
+    for (int i = 0; i < 30; ++i) {
+        pool.submit_detach([] { std::this_thread::sleep_for(std::chrono::milliseconds(5)); });
+    }
+    std::atomic<int> num_droppable_run{0};
+    for (int i = 0; i < 10; ++i) {
+        pool.submit_detach_droppable([&] { ++num_droppable_run; });
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    pool.unpause();
+
+    while (!pool.is_overloaded() && pool.get_num_queued_tasks() > 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    REQUIRE(pool.is_overloaded());
+
+    // new work is rejected while overloaded
+    auto rejected = pool.try_submit([] { return 1; });
+    REQUIRE_FALSE(rejected.valid());
+    REQUIRE_FALSE(pool.try_submit_detach([] {}));
+    REQUIRE(pool.get_num_rejected_tasks() == 2);
+
+    // droppable tasks that waited behind the backlog are shed
+    pool.wait_for_tasks();
+    REQUIRE(num_droppable_run == 0);
+    REQUIRE(pool.get_num_shed_tasks() == 10);
+
+    // an empty queue ends the overload
+    REQUIRE_FALSE(pool.is_overloaded());
+    REQUIRE(pool.try_submit([] { return 1; }).get() == 1);
+
+    // disabling admission control
+    pool.set_admission_control(std::chrono::milliseconds(0));
+    pool.submit_detach_droppable([&] { ++num_droppable_run; });
+    pool.wait_for_tasks();
+    REQUIRE(num_droppable_run == 1);
+}
+
+TEST_CASE("cpu_arbiter", "") {
+    SECTION("tokens") {
+        task_thread_pool::cpu_arbiter arbiter(2);
+        REQUIRE(arbiter.get_num_tokens() == 2);
+        REQUIRE(arbiter.try_acquire());
+        arbiter.acquire();
+        REQUIRE_FALSE(arbiter.try_acquire());
+        REQUIRE(arbiter.get_num_available_tokens() == 0);
+
+        std::thread waiter([&] { arbiter.acquire(); });
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        arbiter.release();
+        waiter.join();
+        REQUIRE(arbiter.get_num_available_tokens() == 0);
+
+        arbiter.release();
+        arbiter.release();
+        REQUIRE(arbiter.get_num_available_tokens() == 2);
+        REQUIRE(task_thread_pool::global_cpu_arbiter().get_num_tokens() > 0);
+    }
+
+    SECTION("shared between pools") {
+        task_thread_pool::cpu_arbiter arbiter(2);
+        std::atomic<int> running{0};
+        std::atomic<int> max_running{0};
+        {
+            task_thread_pool::task_thread_pool pool_a{4};
+            task_thread_pool::task_thread_pool pool_b{4};
+            pool_a.set_cpu_arbiter(&arbiter);
+            pool_b.set_cpu_arbiter(&arbiter);
+            REQUIRE(pool_a.get_cpu_arbiter() == &arbiter);
+
+            auto task = [&] {
+                int now = ++running;
+                int prev = max_running;
+                while (now > prev && !max_running.compare_exchange_weak(prev, now)) {}
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                --running;
+            };
+            for (int i = 0; i < 50; ++i) {
+                pool_a.submit_detach(task);
+                pool_b.submit_detach(task);
+            }
+        }
+        REQUIRE(max_running <= 2);
+        REQUIRE(arbiter.get_num_available_tokens() == 2);
+    }
+
+    SECTION("blocking_scope returns the token") {
+        task_thread_pool::cpu_arbiter arbiter(1);
+        {
+            task_thread_pool::task_thread_pool pool{2};
+            pool.set_cpu_arbiter(&arbiter);
+
+            auto f = pool.submit([&] {
+                auto inner = pool.submit([] { return 3; });
+                task_thread_pool::blocking_scope blocking(pool);
+                return inner.get();
+            });
+            REQUIRE(f.get() == 3);
+        }
+        REQUIRE(arbiter.get_num_available_tokens() == 1);
+    }
+
+    SECTION("stopping interrupts workers waiting for a token") {
+        task_thread_pool::cpu_arbiter arbiter(1);
+        arbiter.acquire();
+
+        REQUIRE_FALSE(arbiter.acquire([] { return true; }));
+
+        std::atomic<int> count{0};
+        {
+            task_thread_pool::task_thread_pool pool{2};
+            pool.set_cpu_arbiter(&arbiter);
+            pool.submit_detach([&] { ++count; });
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+
+            // restarts the workers while one waits for the token held above
+            pool.set_num_threads(1);
+            pool.clear_task_queue();
+        }
+        REQUIRE(count == 0);
+        REQUIRE(arbiter.get_num_available_tokens() == 0);
+        arbiter.release();
+        REQUIRE(arbiter.get_num_available_tokens() == 1);
+    }
+}
+
+TEST_CASE("submit_with_deadline", "") {
+    task_thread_pool::task_thread_pool pool{1};
+    const auto now = std::chrono::steady_clock::now();
+
+    REQUIRE(pool.submit_with_deadline(now + std::chrono::hours(1), [](int x) { return x; }, 5).get() == 5);
+
+    // earliest deadline first, ahead of tasks without a deadline
+    std::vector<int> order;
+    pool.pause();
+    pool.submit_detach([&] { order.push_back(0); });
+    auto f3 = pool.submit_with_deadline(now + std::chrono::hours(3), [&] { order.push_back(3); });
+    auto f1 = pool.submit_with_deadline(now + std::chrono::hours(1), [&] { order.push_back(1); });
+    auto f2 = pool.submit_with_deadline(now + std::chrono::hours(2), [&] { order.push_back(2); });
+    REQUIRE(pool.get_num_queued_tasks() == 4);
+    pool.unpause();
+    pool.wait_for_tasks();
+    REQUIRE(order == std::vector<int>{1, 2, 3, 0});
+
+    // expired tasks are skipped
+    std::atomic<bool> ran{false};
+    pool.pause();
+    auto expired = pool.submit_with_deadline(std::chrono::steady_clock::now() + std::chrono::milliseconds(1),
+                                             [&] { ran = true; });
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    pool.unpause();
+    REQUIRE_THROWS_AS(expired.get(), task_thread_pool::task_expired);
+    REQUIRE_FALSE(ran);
+    REQUIRE(pool.get_num_expired_tasks() == 1);
+
+    // expired tasks do not run the task hooks
+    std::atomic<int> num_started{0};
+    pool.set_task_hooks([&](const char*) { ++num_started; }, nullptr);
+    pool.pause();
+    std::vector<std::future<void>> expiring;
+    for (int i = 0; i < 5; ++i) {
+        expiring.push_back(pool.submit_with_deadline(std::chrono::steady_clock::now(), [&] { ran = true; }));
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    pool.unpause();
+    for (auto& f : expiring) {
+        REQUIRE_THROWS_AS(f.get(), task_thread_pool::task_expired);
+    }
+    pool.wait_for_tasks();
+    REQUIRE_FALSE(ran);
+    REQUIRE(num_started == 0);
+    REQUIRE(pool.get_num_expired_tasks() == 6);
+    pool.set_task_hooks(nullptr, nullptr);
+
+    // tasks without a deadline still run while deadline tasks keep arriving
+    order.clear();
+    pool.pause();
+    pool.submit_detach([&] { order.push_back(0); });
+    std::vector<std::future<void>> urgent;
+    for (int i = 0; i < 20; ++i) {
+        urgent.push_back(pool.submit_with_deadline(now + std::chrono::hours(1), [&] { order.push_back(1); }));
+    }
+    pool.unpause();
+    pool.wait_for_tasks();
+    REQUIRE(order.size() == 21);
+    REQUIRE(order[task_thread_pool::detail::max_deadline_burst] == 0);
+
+    // exceptions thrown by the task itself are propagated
+    auto throws = pool.submit_with_deadline(std::chrono::steady_clock::now() + std::chrono::hours(1),
+                                            [] { throw std::invalid_argument("test"); });
+    REQUIRE_THROWS_AS(throws.get(), std::invalid_argument);
+}
+
+TEST_CASE("task_hooks_and_names", "") {
+    task_thread_pool::task_thread_pool pool{2};
+
+    std::atomic<int> num_before{0};
+    std::atomic<int> num_after{0};
+    std::atomic<int> num_labeled{0};
+    pool.set_task_hooks([&](const char* label) {
+        ++num_before;
+        if (label && std::string(label) == "decode") {
+            ++num_labeled;
+        }
+    }, [&](const char*) { ++num_after; });
+    for (int i = 0; i < 10; ++i) {
+        pool.submit_detach([] {});
+    }
+    pool.submit_detach([] { throw std::invalid_argument("test"); });
+    pool.wait_for_tasks();
+    REQUIRE(num_before == 11);
+    REQUIRE(num_after == 11);
+    REQUIRE(num_labeled == 0);
+
+    pool.submit_detach_labeled("decode", [](int) {}, 1);
+    REQUIRE(pool.submit_labeled("decode", [](int x) { return x; }, 2).get() == 2);
+    pool.wait_for_tasks();
+    REQUIRE(num_labeled == 2);
+    REQUIRE(num_after == 13);
+
+    pool.set_task_hooks(nullptr, nullptr);
+    pool.submit([] {}).get();
+    REQUIRE(num_before == 13);
+
+    pool.set_name("a-long-pool-name");
+    REQUIRE(pool.get_name() == "a-long-pool-name");
+    REQUIRE(pool.get_num_threads() == 2);
+#if defined(__linux__)
+    auto thread_name = pool.submit([] {
+        char buf[16] = {};
+        pthread_getname_np(pthread_self(), buf, sizeof(buf));
+        return std::string(buf) + "/" + std::to_string(task_thread_pool::current_worker_index());
+    }).get();
+    REQUIRE((thread_name == "a-long-pool-n-0/0" || thread_name == "a-long-pool-n-1/1"));
+
+    // running threads are renamed in place, so a task may rename its own pool
+    pool.submit([&] { pool.set_name("renamed"); }).get();
+    REQUIRE(pool.get_name() == "renamed");
+    thread_name = pool.submit([] {
+        char buf[16] = {};
+        pthread_getname_np(pthread_self(), buf, sizeof(buf));
+        return std::string(buf) + "/" + std::to_string(task_thread_pool::current_worker_index());
+    }).get();
+    REQUIRE((thread_name == "renamed-0/0" || thread_name == "renamed-1/1"));
+#endif
+}
+
+TEST_CASE("cancellation", "") {
+    task_thread_pool::task_thread_pool pool{1};
+    auto resource = std::make_shared<int>(0);
+    std::atomic<int> num_started{0};
+    pool.set_task_hooks([&](const char*) { ++num_started; }, nullptr);
+
+    pool.pause();
+    auto first = pool.submit_cancellable([resource] { return 1; });
+    auto second = pool.submit_cancellable([resource] { return 2; });
+    std::atomic<bool> detached_ran{false};
+    auto detached = pool.submit_detach_cancellable([resource, &detached_ran] { detached_ran = true; });
+    REQUIRE(resource.use_count() == 4);
+
+    // cancelling releases captured resources immediately, before any worker reaches the task
+    REQUIRE(second.second.cancel());
+    REQUIRE(resource.use_count() == 3);
+    REQUIRE_FALSE(second.second.cancel());
+    REQUIRE_THROWS_AS(second.first.get(), task_thread_pool::task_cancelled);
+
+    REQUIRE(detached.cancel());
+    REQUIRE(resource.use_count() == 2);
+
+    pool.unpause();
+    REQUIRE(first.first.get() == 1);
+    pool.wait_for_tasks();
+    REQUIRE_FALSE(detached_ran);
+
+    // cancelled tasks are skipped without running the task hooks
+    REQUIRE(num_started == 1);
+
+    // too late to cancel a task that has run
+    REQUIRE_FALSE(first.second.cancel());
+    REQUIRE(resource.use_count() == 1);
+
+    // tasks cleared from the queue break their promise even if a handle is still alive
+    pool.pause();
+    auto cleared = pool.submit_cancellable([resource] { return 3; });
+    pool.clear_task_queue();
+    REQUIRE(resource.use_count() == 1);
+    REQUIRE_THROWS_AS(cleared.first.get(), std::future_error);
+    REQUIRE_FALSE(cleared.second.cancel());
+    pool.unpause();
+
+    REQUIRE_FALSE(task_thread_pool::cancellation_handle().cancel());
+}
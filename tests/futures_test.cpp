@@ -0,0 +1,116 @@
+// Copyright (C) 2023 Adam Lugowski. All rights reserved.
+// Use of this source code is governed by the BSD 2-clause license, the MIT license, or at your choosing the BSL-1.0 license found in the LICENSE.*.txt files.
+// SPDX-License-Identifier: BSD-2-Clause OR MIT OR BSL-1.0
+
+#include <catch2/catch_test_macros.hpp>
+#include <task_thread_pool_futures.hpp>
+
+TEST_CASE("future_group-when_all", "[futures]") {
+    task_thread_pool::task_thread_pool pool;
+    task_thread_pool::future_group<int> group(pool);
+    REQUIRE(group.when_all().empty());
+
+    for (int i = 0; i < 100; ++i) {
+        REQUIRE(group.submit([](int arg) { return arg; }, i) == static_cast<size_t>(i));
+    }
+    REQUIRE(group.size() == 100);
+
+    int sum = 0;
+    for (auto& f : group.when_all()) {
+        REQUIRE(f.wait_for(std::chrono::seconds(0)) == std::future_status::ready);
+        sum += f.get();
+    }
+    REQUIRE(sum == 4950);
+}
+
+TEST_CASE("future_group-when_any", "[futures]") {
+    task_thread_pool::task_thread_pool pool(2);
+    task_thread_pool::future_group<int> group(pool);
+
+    std::atomic<bool> go{false};
+    group.submit([&] { while (!go) {} return 0; });
+    group.submit([] { return 1; });
+
+    REQUIRE(group.when_any() == 1);
+    REQUIRE(group[1].get() == 1);
+
+    go = true;
+    REQUIRE(group[0].get() == 0);
+}
+
+TEST_CASE("future_group-as_completed", "[futures]") {
+    // one thread per task because tasks wait for each other
+    task_thread_pool::task_thread_pool pool(10);
+    task_thread_pool::future_group<void> group(pool);
+
+    // tasks finish in reverse submission order
+    std::atomic<int> turn{9};
+    for (int i = 0; i < 10; ++i) {
+        group.submit([&turn, i] {
+            while (turn != i) { std::this_thread::yield(); }
+            --turn;
+        });
+    }
+
+    size_t expected = 9;
+    size_t count = 0;
+    auto completed = group.as_completed();
+    for (auto it = completed.begin(); it != completed.end(); ++it) {
+        REQUIRE(it.index() == expected--);
+        REQUIRE_NOTHROW(it->get());
+        ++count;
+    }
+    REQUIRE(count == 10);
+}
+
+TEST_CASE("future_group-exception", "[futures]") {
+    task_thread_pool::task_thread_pool pool;
+    task_thread_pool::future_group<int> group(pool);
+    group.submit([]() -> int { throw std::invalid_argument("test"); });
+    group.submit([] { return 2; });
+
+    int num_errors = 0;
+    int sum = 0;
+    for (auto& f : group.as_completed()) {
+        try {
+            sum += f.get();
+        } catch (std::invalid_argument&) {
+            ++num_errors;
+        }
+    }
+    REQUIRE(num_errors == 1);
+    REQUIRE(sum == 2);
+}
+
+TEST_CASE("future_group-dropped", "[futures]") {
+    task_thread_pool::task_thread_pool pool;
+    task_thread_pool::future_group<int> group(pool);
+
+    pool.pause();
+    group.submit([] { return 1; });
+    group.submit([] { return 2; });
+    pool.clear_task_queue();
+    pool.unpause();
+
+    REQUIRE(group.when_any() < 2);
+    for (auto& f : group.when_all()) {
+        REQUIRE(f.wait_for(std::chrono::seconds(0)) == std::future_status::ready);
+        REQUIRE_THROWS_AS(f.get(), std::future_error);
+    }
+}
+
+TEST_CASE("future_group-policy-pool", "[futures]") {
+    using lifo_pool = task_thread_pool::basic_task_thread_pool<task_thread_pool::lifo_queue>;
+    lifo_pool pool(4);
+    task_thread_pool::future_group<int, lifo_pool> group(pool);
+
+    for (int i = 0; i < 100; ++i) {
+        group.submit([](int arg) { return arg; }, i);
+    }
+
+    int sum = 0;
+    for (auto& f : group.as_completed()) {
+        sum += f.get();
+    }
+    REQUIRE(sum == 4950);
+}
@@ -0,0 +1,158 @@
+// Copyright (C) 2023 Adam Lugowski. All rights reserved.
+// Use of this source code is governed by the BSD 2-clause license, the MIT license, or at your choosing the BSL-1.0 license found in the LICENSE.*.txt files.
+// SPDX-License-Identifier: BSD-2-Clause OR MIT OR BSL-1.0
+
+#include <catch2/catch_test_macros.hpp>
+#include <task_thread_pool_pipeline.hpp>
+
+struct item {
+    int value = 0;
+    int doubled = 0;
+};
+
+TEST_CASE("pipeline-in-order", "[pipeline]") {
+    task_thread_pool::task_thread_pool pool(4);
+
+    for (size_t max_tokens : {1, 2, 8}) {
+        int next_input = 0;
+        std::vector<int> output;
+        std::atomic<int> in_flight{0};
+        std::atomic<int> max_in_flight{0};
+
+        task_thread_pool::pipeline<item> p([&](item& it) {
+            if (next_input == 1000) {
+                return false;
+            }
+            it.value = next_input++;
+            int now = ++in_flight;
+            int prev = max_in_flight;
+            while (now > prev && !max_in_flight.compare_exchange_weak(prev, now)) {}
+            return true;
+        });
+        p.add_stage(task_thread_pool::stage_mode::parallel, [](item& it) { it.doubled = 2 * it.value; })
+         .add_stage(task_thread_pool::stage_mode::serial_out_of_order, [](item& it) { ++it.doubled; })
+         .add_stage(task_thread_pool::stage_mode::serial_in_order, [&](item& it) {
+             output.push_back(it.doubled);
+             --in_flight;
+         });
+
+        p.run(pool, max_tokens);
+
+        REQUIRE(output.size() == 1000);
+        for (int i = 0; i < 1000; ++i) {
+            REQUIRE(output[i] == 2 * i + 1);
+        }
+        REQUIRE(max_in_flight <= static_cast<int>(max_tokens));
+    }
+}
+
+TEST_CASE("pipeline-serial-stage-exclusive", "[pipeline]") {
+    task_thread_pool::task_thread_pool pool(4);
+    int num_inputs = 0;
+    int count = 0;
+    std::atomic<int> inside{0};
+    bool overlapped = false;
+
+    task_thread_pool::pipeline<item> p([&](item&) { return num_inputs++ < 500; });
+    p.add_stage(task_thread_pool::stage_mode::serial_out_of_order, [&](item&) {
+        if (++inside > 1) {
+            overlapped = true;
+        }
+        ++count;
+        --inside;
+    });
+    p.run(pool, 8);
+
+    REQUIRE(count == 500);
+    REQUIRE_FALSE(overlapped);
+}
+
+TEST_CASE("pipeline-exception", "[pipeline]") {
+    task_thread_pool::task_thread_pool pool(2);
+    int next_input = 0;
+    std::atomic<int> written{0};
+
+    task_thread_pool::pipeline<item> p([&](item& it) {
+        it.value = next_input++;
+        return true;  // infinite source, stopped by the exception
+    });
+    p.add_stage(task_thread_pool::stage_mode::parallel, [](item& it) {
+        if (it.value == 100) throw std::invalid_argument("test");
+    }).add_stage(task_thread_pool::stage_mode::serial_in_order, [&](item&) { ++written; });
+
+    REQUIRE_THROWS_AS(p.run(pool, 4), std::invalid_argument);
+    REQUIRE(written < next_input);
+
+    // the pool still works
+    REQUIRE(pool.submit([] { return 1; }).get() == 1);
+}
+
+TEST_CASE("pipeline-exception-skips-items-in-flight", "[pipeline]") {
+    task_thread_pool::task_thread_pool pool(2);
+    int next_input = 0;
+    std::atomic<bool> second_item_done{false};
+    std::atomic<int> written{0};
+
+    task_thread_pool::pipeline<item> p([&](item& it) {
+        it.value = next_input++;
+        return it.value < 2;
+    });
+    p.add_stage(task_thread_pool::stage_mode::parallel, [&](item& it) {
+        if (it.value == 1) {
+            second_item_done = true;
+            return;
+        }
+        // the second item waits at the next stage for this one
+        const auto give_up = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        while (!second_item_done && std::chrono::steady_clock::now() < give_up) {
+            std::this_thread::yield();
+        }
+        throw std::invalid_argument("test");
+    }).add_stage(task_thread_pool::stage_mode::serial_in_order, [&](item&) { ++written; });
+
+    REQUIRE_THROWS_AS(p.run(pool, 2), std::invalid_argument);
+    REQUIRE(second_item_done);
+    REQUIRE(written == 0);
+}
+
+TEST_CASE("pipeline-empty-and-from-task", "[pipeline]") {
+    task_thread_pool::task_thread_pool pool(1);
+
+    task_thread_pool::pipeline<item> empty([](item&) { return false; });
+    empty.add_stage(task_thread_pool::stage_mode::serial_in_order, [](item&) {});
+    empty.run(pool);
+
+    // running a pipeline from a task on a single-threaded pool must not deadlock
+    auto f = pool.submit([&] {
+        int n = 0;
+        int sum = 0;
+        task_thread_pool::pipeline<item> p([&](item& it) { it.value = n; return n++ < 100; });
+        p.add_stage(task_thread_pool::stage_mode::serial_in_order, [&](item& it) { sum += it.value; });
+        p.run(pool, 4);
+        return sum;
+    });
+    REQUIRE(f.get() == 4950);
+}
+
+TEST_CASE("pipeline-policy-pool", "[pipeline]") {
+    task_thread_pool::basic_task_thread_pool<task_thread_pool::lifo_queue> pool(4);
+
+    int next_input = 0;
+    std::vector<int> output;
+    task_thread_pool::pipeline<item> p([&](item& it) {
+        if (next_input == 1000) {
+            return false;
+        }
+        it.value = next_input++;
+        return true;
+    });
+    p.add_stage(task_thread_pool::stage_mode::parallel, [](item& it) { it.doubled = 2 * it.value; })
+     .add_stage(task_thread_pool::stage_mode::serial_in_order, [&](item& it) { output.push_back(it.doubled); });
+
+    p.run(pool);
+
+    REQUIRE(output.size() == 1000);
+    for (int i = 0; i < 1000; ++i) {
+        REQUIRE(output[i] == 2 * i);
+    }
+}
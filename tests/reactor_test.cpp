@@ -0,0 +1,118 @@
+// Copyright (C) 2023 Adam Lugowski. All rights reserved.
+// Use of this source code is governed by the BSD 2-clause license, the MIT license, or at your choosing the BSL-1.0 license found in the LICENSE.*.txt files.
+// SPDX-License-Identifier: BSD-2-Clause OR MIT OR BSL-1.0
+
+#if defined(__linux__)
+
+#include <catch2/catch_test_macros.hpp>
+#include <task_thread_pool_reactor.hpp>
+
+#include "common.hpp"
+
+TEST_CASE("reactor-pipe", "[reactor]") {
+    int fds[2];
+    REQUIRE(::pipe(fds) == 0);
+
+    task_thread_pool::task_thread_pool pool(2);
+    task_thread_pool::epoll_reactor reactor(pool);
+
+    std::promise<std::thread::id> handler_thread;
+    std::atomic<int> bytes_read{0};
+    std::atomic<uint32_t> all_events{0};
+    reactor.add(fds[0], EPOLLIN, [&](uint32_t events) {
+        all_events |= events;
+        char buf[16];
+        ssize_t n = ::read(fds[0], buf, sizeof(buf));
+        if (bytes_read.fetch_add(static_cast<int>(n)) == 0) {
+            handler_thread.set_value(std::this_thread::get_id());
+        }
+    });
+
+    REQUIRE(::write(fds[1], "x", 1) == 1);
+    REQUIRE(handler_thread.get_future().get() != std::this_thread::get_id());
+    REQUIRE(bytes_read == 1);
+    REQUIRE((all_events & EPOLLIN) != 0);
+
+    reactor.remove(fds[0]);
+    REQUIRE(::write(fds[1], "y", 1) == 1);
+    std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    REQUIRE(bytes_read == 1);
+
+    REQUIRE_THROWS_AS(reactor.remove(fds[0]), std::system_error);
+
+    ::close(fds[0]);
+    ::close(fds[1]);
+}
+
+TEST_CASE("reactor-eventfd-oneshot", "[reactor]") {
+    int efd = ::eventfd(0, EFD_NONBLOCK);
+    REQUIRE(efd >= 0);
+
+    task_thread_pool::task_thread_pool pool(1);
+    task_thread_pool::epoll_reactor reactor(pool);
+
+    std::atomic<int> count{0};
+    std::atomic<int> num_failed_reads{0};
+    reactor.add(efd, EPOLLIN | EPOLLONESHOT, [&](uint32_t) {
+        uint64_t value;
+        if (::read(efd, &value, sizeof(value)) != sizeof(value)) {
+            ++num_failed_reads;
+        }
+        ++count;
+    });
+
+    for (int i = 1; i <= 3; ++i) {
+        uint64_t one = 1;
+        REQUIRE(::write(efd, &one, sizeof(one)) == sizeof(one));
+        while (count < i) {
+            std::this_thread::yield();
+        }
+        reactor.modify(efd, EPOLLIN | EPOLLONESHOT);
+    }
+    REQUIRE(count == 3);
+    REQUIRE(num_failed_reads == 0);
+    ::close(efd);
+}
+
+TEST_CASE("reactor-tasks-still-run", "[reactor]") {
+    // The only worker is polling. Submitting a task must wake it.
+    task_thread_pool::task_thread_pool pool(1);
+    task_thread_pool::epoll_reactor reactor(pool);
+    std::this_thread::sleep_for(std::chrono::milliseconds(2));
+
+    for (int i = 0; i < 100; ++i) {
+        REQUIRE(pool.submit([i] { return i; }).get() == i);
+    }
+
+    pool.pause();
+    auto f = pool.submit([] { return 1; });
+    pool.unpause();
+    REQUIRE(f.get() == 1);
+    REQUIRE(measure_number_of_threads(pool) == 1);
+}
+
+
+TEST_CASE("reactor-policy-pool", "[reactor]") {
+    int efd = ::eventfd(0, EFD_NONBLOCK);
+    REQUIRE(efd >= 0);
+
+    task_thread_pool::basic_task_thread_pool<task_thread_pool::lifo_queue> pool(1);
+    task_thread_pool::epoll_reactor reactor(pool);
+
+    std::promise<uint64_t> read_value;
+    reactor.add(efd, EPOLLIN, [&](uint32_t) {
+        uint64_t value = 0;
+        if (::read(efd, &value, sizeof(value)) == sizeof(value)) {
+            read_value.set_value(value);
+        }
+    });
+
+    uint64_t seven = 7;
+    REQUIRE(::write(efd, &seven, sizeof(seven)) == sizeof(seven));
+    REQUIRE(read_value.get_future().get() == 7);
+
+    reactor.remove(efd);
+    ::close(efd);
+}
+
+#endif
@@ -0,0 +1,126 @@
+// Copyright (C) 2023 Adam Lugowski. All rights reserved.
+// Use of this source code is governed by the BSD 2-clause license, the MIT license, or at your choosing the BSL-1.0 license found in the LICENSE.*.txt files.
+// SPDX-License-Identifier: BSD-2-Clause OR MIT OR BSL-1.0
+
+#include <catch2/catch_test_macros.hpp>
+#include <task_thread_pool_view.hpp>
+
+#include "common.hpp"
+
+TEST_CASE("view-sum", "") {
+    std::atomic<int> count{0};
+    {
+        task_thread_pool::task_thread_pool pool;
+        task_thread_pool::executor_view view(pool, 2);
+
+        for (int i = 0; i < 100; ++i) {
+            view.submit_detach([&] { ++count; });
+        }
+        view.wait_for_tasks();
+        REQUIRE(count == 100);
+
+        auto f = view.submit([](int arg) { return arg; }, 5);
+        REQUIRE(f.get() == 5);
+    }
+}
+
+TEST_CASE("view-max-concurrency", "") {
+    task_thread_pool::task_thread_pool pool(8);
+    task_thread_pool::executor_view view(pool, 2);
+    REQUIRE(view.get_max_concurrency() == 2);
+
+    std::atomic<int> running{0};
+    std::atomic<int> max_running{0};
+
+    for (int i = 0; i < 50; ++i) {
+        view.submit_detach([&] {
+            int now = ++running;
+            int prev = max_running;
+            while (now > prev && !max_running.compare_exchange_weak(prev, now)) {}
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+            --running;
+        });
+        REQUIRE(view.get_num_running_tasks() <= 2);
+    }
+    view.wait_for_tasks();
+    REQUIRE(max_running <= 2);
+    REQUIRE(max_running >= 1);
+}
+
+TEST_CASE("view-leaves-workers-free", "") {
+    task_thread_pool::task_thread_pool pool(2);
+    task_thread_pool::executor_view batch(pool, 1);
+
+    std::atomic<bool> go{false};
+    for (int i = 0; i < 10; ++i) {
+        batch.submit_detach([&] { while (!go) {} });
+    }
+
+    // the batch view occupies at most one worker, so the pool can still run other tasks
+    REQUIRE(pool.submit([] { return 1; }).get() == 1);
+    REQUIRE(batch.get_num_queued_tasks() == 9);
+
+    go = true;
+    batch.wait_for_tasks();
+    REQUIRE(batch.get_num_queued_tasks() == 0);
+    REQUIRE(batch.get_num_running_tasks() == 0);
+}
+
+TEST_CASE("view-bounded-queue", "") {
+    task_thread_pool::task_thread_pool pool(1);
+    task_thread_pool::executor_view view(pool, 1, 2);
+
+    std::atomic<bool> go{false};
+    std::atomic<bool> task_started{false};
+    REQUIRE(view.try_submit_detach([&] { task_started = true; while (!go) {} }));
+    REQUIRE(view.try_submit_detach([] {}));
+    REQUIRE(view.try_submit_detach([] {}));
+    REQUIRE_FALSE(view.try_submit_detach([] {}));
+    REQUIRE(view.get_num_queued_tasks() == 2);
+
+    go = true;
+    view.wait_for_tasks();
+    REQUIRE(view.try_submit_detach([] {}));
+}
+
+TEST_CASE("view-task-throws", "") {
+    task_thread_pool::task_thread_pool pool;
+    task_thread_pool::executor_view view(pool);
+    auto f = view.submit([]{ throw std::invalid_argument("test"); });
+    REQUIRE_THROWS_AS(f.get(), std::invalid_argument);
+    REQUIRE(view.submit([] { return 2; }).get() == 2);
+}
+
+TEST_CASE("view-pool-queue-cleared", "") {
+    task_thread_pool::task_thread_pool pool;
+    task_thread_pool::executor_view view(pool, 1);
+
+    pool.pause();
+    auto dropped = view.submit([] { return 1; });
+    auto queued = view.submit([] { return 2; });
+    pool.clear_task_queue();
+    pool.unpause();
+
+    REQUIRE_THROWS_AS(dropped.get(), std::future_error);
+    REQUIRE(queued.get() == 2);
+    REQUIRE(view.submit([] { return 3; }).get() == 3);
+    view.wait_for_tasks();
+    REQUIRE(view.get_num_running_tasks() == 0);
+}
+
+TEST_CASE("view-policy-pool", "") {
+    task_thread_pool::basic_task_thread_pool<task_thread_pool::lifo_queue> pool(4);
+    task_thread_pool::executor_view view(pool);
+    REQUIRE(view.get_max_concurrency() == 4);
+
+    std::atomic<int> count{0};
+    for (int i = 0; i < 100; ++i) {
+        view.submit_detach([&] { ++count; });
+    }
+    view.wait_for_tasks();
+    REQUIRE(count == 100);
+
+    view.set_max_concurrency(0);
+    REQUIRE(view.get_max_concurrency() == 4);
+    REQUIRE(view.submit([](int arg) { return arg; }, 5).get() == 5);
+}